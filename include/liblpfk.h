@@ -46,7 +46,198 @@
 #ifndef _liblpfk_h_included
 #define _liblpfk_h_included
 
+#include <sys/types.h>
+#include <pthread.h>
 #include <termios.h>
+#include <time.h>
+
+typedef struct lpfk_ctx LPFK_CTX;
+typedef struct lpfk_transport LPFK_TRANSPORT;
+
+/**
+ * @brief	LPFK protocol timing and retry policy
+ *
+ * All times are in milliseconds, measured on the monotonic clock. When a
+ * command has to be retried, the library waits backoff_ms before the second
+ * attempt, doubling the delay for each further attempt up to a maximum of
+ * backoff_max_ms.
+ *
+ * lpfk_open() starts probing for the LPFK as soon as it has been taken out
+ * of reset, sending a probe every probe_timeout_ms until the LPFK answers.
+ * It gives up once open_timeout_ms has passed or probe_attempts probes have
+ * gone unanswered, whichever comes first.
+ */
+typedef struct {
+	int		open_timeout_ms;	///< Maximum time lpfk_open() waits for the LPFK (0 = no limit)
+	int		reset_delay_ms;		///< Delay between releasing reset and probing
+	int		probe_timeout_ms;	///< Time to wait for a probe response
+	int		probe_attempts;		///< Number of probes to send before giving up (0 = no limit)
+	int		ack_timeout_ms;		///< Time to wait for an LED update ACK
+	int		ack_attempts;		///< Number of times to send an LED update
+	int		backoff_ms;			///< Delay before the first retry
+	int		backoff_max_ms;		///< Maximum delay between retries
+} LPFK_TIMING;
+
+/**
+ * @brief	LPFK open flags, for LPFK_OPTIONS.flags
+ */
+enum {
+	/**
+	 * Start a background I/O thread which owns the serial port. Keys are
+	 * passed to the application through a lock-free queue, so lpfk_read()
+	 * never makes a system call, and LED updates are queued for the thread
+	 * to send, so lpfk_update_leds() never waits for the LPFK.
+	 */
+	LPFK_OPT_IO_THREAD = 0x0001,
+	/**
+	 * Ask the serial port to pass on received bytes straight away, rather
+	 * than batching them up: ASYNC_LOW_LATENCY, and a 1 ms latency timer
+	 * on ftdi_sio adapters (which hold bytes for 16 ms by default). Both
+	 * are put back when the LPFK is closed. lpfk_get_low_latency() says
+	 * which took effect.
+	 */
+	LPFK_OPT_LOW_LATENCY = 0x0002
+};
+
+/**
+ * @brief	Low latency settings, returned by lpfk_get_low_latency()
+ */
+enum {
+	LPFK_LOWLAT_SERIAL = 0x0001,	///< ASYNC_LOW_LATENCY is set on the port
+	LPFK_LOWLAT_TIMER = 0x0002		///< The adapter's latency timer is at 1 ms
+};
+
+/**
+ * @brief	Local echo modes, for lpfk_set_echo()
+ */
+enum {
+	LPFK_ECHO_NONE = 0,			///< Leave the LED alone
+	LPFK_ECHO_TOGGLE,			///< Invert the LED
+	LPFK_ECHO_MOMENTARY,		///< Light the LED for a while
+	LPFK_ECHO_RADIO				///< Light the LED, and turn off the rest of its group
+};
+
+/**
+ * @brief	LPFK open options, passed to lpfk_open_ex().
+ */
+typedef struct {
+	LPFK_TIMING		timing;		///< Protocol timing and retry policy
+	int				flags;		///< LPFK_OPT_* flags
+	const char		*trace_path;	///< Record the serial traffic to this file (see lpfk_trace.h), or NULL
+	int				trace_records;	///< Size of the trace ring in records, 0 for the default
+} LPFK_OPTIONS;
+
+/**
+ * @brief	LED update completion callback
+ * @param	ctx		LPFK context the update was submitted on.
+ * @param	result	LPFK_E_OK if the LPFK acknowledged the new LED state,
+ * 					LPFK_E_COMMS if it did not.
+ * @param	user	User data pointer passed to lpfk_update_leds_async().
+ */
+typedef void (*LPFK_UPDATE_CB)(LPFK_CTX *ctx, const int result, void *user);
+
+/// Maximum length of a serial port path returned by lpfk_discover()
+#define LPFK_PATH_MAX		256
+
+/// Serial ports searched by lpfk_discover() if no pattern is given
+#define LPFK_DEFAULT_PORTS	"/dev/tty{S,USB,ACM}[0-9]*"
+
+/// LED mask bit for LED/key number n (0-31)
+#define LPFK_LED(n)			(1UL << (n))
+
+/// LED mask with all 32 LEDs set
+#define LPFK_LED_ALL		0xFFFFFFFFUL
+
+/// Number of keycodes which can be buffered in an LPFK context
+#define LPFK_KEYQ_SIZE		64
+
+/**
+ * @brief	Key event, returned by lpfk_read_batch().
+ */
+typedef struct {
+	int				key;		///< Key number, 0-31 for key 1-32 down
+	struct timespec	time;		///< CLOCK_MONOTONIC time the key was read from the port
+} LPFK_KEY_EVENT;
+
+/**
+ * @brief	Serial port with an LPFK attached, found by lpfk_discover().
+ */
+typedef struct {
+	char	path[LPFK_PATH_MAX];	///< Serial port path
+} LPFK_PORT_INFO;
+
+/// Number of buckets in each LPFK_STATS histogram
+#define LPFK_STATS_BUCKETS	24
+
+/// Upper bound of histogram bucket i, in microseconds. Bucket i counts
+/// samples at least LPFK_STATS_BUCKET_US(i-1) and less than this; the last
+/// bucket counts everything longer.
+#define LPFK_STATS_BUCKET_US(i)	(1LL << (i))
+
+/**
+ * @brief	Traffic and error counters, returned by lpfk_get_stats().
+ */
+typedef struct {
+	unsigned long long	bytes_tx;		///< Bytes written to the LPFK
+	unsigned long long	bytes_rx;		///< Bytes read from the LPFK
+	unsigned long long	probes;			///< READ CONFIGURATION probes sent by lpfk_open
+	unsigned long long	frames_tx;		///< LED frames sent, including retransmissions
+	unsigned long long	retransmits;	///< 0x80 retransmit requests from the LPFK
+	unsigned long long	ack_timeouts;	///< LED frames the LPFK didn't answer in time
+	unsigned long long	update_failures;	///< LED updates which ran out of attempts
+	unsigned long long	keys_rx;		///< Keycodes received
+	unsigned long long	keys_invalid;	///< Bytes received which weren't keycodes or responses
+	unsigned long long	keys_dropped;	///< Keycodes lost: keyboard disabled, or queue full
+	unsigned long long	ack_latency[LPFK_STATS_BUCKETS];	///< LED frame sent to 0x81 received
+	unsigned long long	key_dwell[LPFK_STATS_BUCKETS];	///< keycode received to read by the application
+} LPFK_STATS;
+
+/**
+ * @brief	Transport operations
+ *
+ * A transport carries bytes between the protocol engine and the LPFK: a
+ * serial port, a socket, or something which never leaves the process. None
+ * of the operations may block.
+ */
+typedef struct {
+	/// Send bytes to the LPFK. Returns the number sent, or -1 on error.
+	ssize_t	(*write)(LPFK_TRANSPORT *t, const void *buf, const size_t len);
+	/// Take bytes the LPFK has sent. Returns the number taken; 0 or -1 if
+	/// there are none.
+	ssize_t	(*read)(LPFK_TRANSPORT *t, void *buf, const size_t len);
+	/// Milliseconds until there will be bytes to read: 0 if there are some
+	/// now, -1 if none are expected. Only needed by transports with no
+	/// descriptor to poll; NULL for the rest.
+	int		(*rx_timeout)(LPFK_TRANSPORT *t);
+	/// Throw away anything received but not yet read.
+	void	(*flush_input)(LPFK_TRANSPORT *t);
+	/// Hold the LPFK in reset (true) or let it run (false). NULL if the
+	/// transport has no reset line.
+	void	(*set_reset)(LPFK_TRANSPORT *t, const int reset);
+	/// Cut the time received bytes wait before they can be read. Returns
+	/// the LPFK_LOWLAT_* settings in effect; close() undoes the rest. NULL
+	/// if the transport has nothing to tune.
+	int		(*low_latency)(LPFK_TRANSPORT *t);
+	/// Release the transport's resources.
+	void	(*close)(LPFK_TRANSPORT *t);
+} LPFK_TRANSPORT_OPS;
+
+/**
+ * @brief	Transport between the protocol engine and the LPFK
+ *
+ * Set up by lpfk_transport_tty(), lpfk_transport_fd(), lpfk_sim_transport()
+ * or the application, and handed to lpfk_open_transport().
+ */
+struct lpfk_transport {
+	const LPFK_TRANSPORT_OPS	*ops;	///< transport operations
+	int				fd;			///< descriptor which polls readable (POLLIN) when
+								///< the LPFK has sent something, or -1 if none
+	void			*priv;		///< transport's private data
+	struct termios	oldtio;		///< serial port settings to restore on close
+	int				lowlat;		///< LPFK_LOWLAT_* settings in effect
+	int				old_serial_flags;	///< ASYNC_* flags to restore on close, -1 if none
+	int				old_latency_ms;		///< latency timer to restore on close, -1 if none
+};
 
 /**
  * @brief	LPFK context
@@ -54,12 +245,42 @@
  * Do not change any variables inside this struct, they are for liblpfk's
  * internal use only.
  */
-typedef struct {
-	int				fd;			///< serial port file descriptor
-	struct termios	oldtio;		///< old termios setup
+struct lpfk_ctx {
+	LPFK_TRANSPORT	transport;	///< connection to the LPFK
 	int				enabled;	///< LPFK enabled
-	unsigned long	led_mask;	///< lit LEDs mask
-} LPFK_CTX;
+	unsigned long	led_mask;	///< lit LEDs mask (bit n = LED n), atomic
+	unsigned long	shown_mask;	///< LED mask the LPFK last acknowledged
+	int				shown_valid;	///< shown_mask is known to be on the LPFK
+	int				enable_want;	///< keyboard state to send to the LPFK
+	int				enable_sent;	///< keyboard state last sent (-1 = unknown)
+	LPFK_TIMING		timing;		///< protocol timing and retry policy
+
+	int				upd_state;		///< LED update state machine state
+	unsigned long	upd_mask;		///< LED mask being sent
+	unsigned char	upd_frame[5];	///< LED update frame being sent
+	int				upd_attempt;	///< LED update transmit attempt number
+	long long		upd_deadline;	///< LED update ACK deadline (ms)
+	int				upd_result;		///< result of last LED update
+	LPFK_UPDATE_CB	upd_cb;			///< LED update completion callback
+	void			*upd_user;		///< LED update callback user data
+	long long		upd_sent;		///< time the LED frame was last sent (ns)
+	unsigned int	flush_gen;		///< lpfk_flush_leds() request count
+	pthread_t		owner;			///< thread which opened the context
+
+	int				echo[32];		///< local echo mode | (parameter << 8) per key
+	unsigned long	echo_timed;		///< LEDs lit by a momentary echo
+	long long		echo_off[32];	///< time to turn momentary echoes off (ms)
+	int				echo_pending;	///< echo waiting for the LPFK to be free
+
+	LPFK_KEY_EVENT	keyq[LPFK_KEYQ_SIZE];	///< received key events
+	unsigned int	keyq_head;		///< next keyq slot to fill
+	unsigned int	keyq_tail;		///< next keyq slot to empty
+
+	struct lpfk_iothread	*io;	///< I/O thread state, NULL if not used
+	struct lpfk_trace	*trace;		///< serial traffic trace, NULL if not recording
+
+	LPFK_STATS		stats;			///< traffic and error counters
+};
 
 /**
  * @brief	liblpfk error codes
@@ -71,7 +292,8 @@ enum {
 	LPFK_E_NOT_PRESENT = -3,	///< LPFK not present on specified port.
 	LPFK_E_COMMS = -4,			///< Communication error.
 	LPFK_E_PARAM = -5,			///< Invalid function parameter.
-	LPFK_E_NOT_ENABLED = -6		///< Attempt to read key when LPFK disabled
+	LPFK_E_NOT_ENABLED = -6,	///< Attempt to read key when LPFK disabled
+	LPFK_E_BUSY = -7			///< Operation still in progress
 };
 
 /**
@@ -85,6 +307,148 @@ enum {
  */
 int lpfk_open(LPFK_CTX *ctx, const char *port);
 
+/**
+ * @brief	Open a serial port and attempt to connect to an LPFK on that
+ * 			port, using non-default options.
+ * @param	ctx		Pointer to an LPFK_CTX struct where LPFK context will be
+ * 					stored.
+ * @param	port	Serial port path (e.g. /dev/ttyS0).
+ * @param	opts	Open options, initialised by lpfk_default_options(). NULL
+ * 					to use the defaults.
+ * @return	LPFK_E_OK on success, LPFK_E_PORT_OPEN if port could not be
+ * 			opened, LPFK_E_NOT_PRESENT if no LPFK present on specified port,
+ * 			LPFK_E_PARAM if the options are invalid or the trace file could
+ * 			not be created.
+ */
+int lpfk_open_ex(LPFK_CTX *ctx, const char *port, const LPFK_OPTIONS *opts);
+
+/**
+ * @brief	Connect to an LPFK over a transport other than a serial port.
+ * @param	ctx		Pointer to an LPFK_CTX struct where LPFK context will be
+ * 					stored.
+ * @param	t		Transport to the LPFK. The context takes it over: it is
+ * 					closed by lpfk_close(), or straight away if this fails.
+ * @param	opts	Open options, initialised by lpfk_default_options(). NULL
+ * 					to use the defaults.
+ * @return	LPFK_E_OK on success, LPFK_E_NOT_PRESENT if no LPFK answered,
+ * 			LPFK_E_PARAM if the options are invalid or the trace file could
+ * 			not be created.
+ * @note	lpfk_open_ex() is lpfk_transport_tty() followed by this.
+ */
+int lpfk_open_transport(LPFK_CTX *ctx, LPFK_TRANSPORT *t,
+		const LPFK_OPTIONS *opts);
+
+/**
+ * @brief	Set up a serial port transport. Works with ptys as well.
+ * @param	t		Pointer to an LPFK_TRANSPORT struct to initialise.
+ * @param	port	Serial port path (e.g. /dev/ttyS0).
+ * @return	LPFK_E_OK on success, LPFK_E_PORT_OPEN if the port could not be
+ * 			opened.
+ * @note	The port is set to 9600 baud 8O1. RTS is the LPFK's reset line:
+ * 			lpfk_open_transport() asserts it to take the LPFK out of reset,
+ * 			and lpfk_close() drops it again.
+ */
+int lpfk_transport_tty(LPFK_TRANSPORT *t, const char *port);
+
+/**
+ * @brief	Set up a transport on a descriptor which is already connected
+ * 			to an LPFK, such as one end of a socketpair or a socket to a
+ * 			serial server.
+ * @param	t		Pointer to an LPFK_TRANSPORT struct to initialise.
+ * @param	fd		Byte stream descriptor. The transport takes it over and
+ * 					makes it non-blocking.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad descriptor.
+ * @note	There is no reset line, so the LPFK at the other end must
+ * 			already be running.
+ */
+int lpfk_transport_fd(LPFK_TRANSPORT *t, const int fd);
+
+/**
+ * @brief	Search a set of serial ports for LPFKs.
+ * @param	pattern	glob(3) pattern matching the ports to search, brace
+ * 					expressions allowed. NULL to use LPFK_DEFAULT_PORTS.
+ * @param	found	Array to receive the ports an LPFK answered on.
+ * @param	max		Number of entries in the found array.
+ * @param	timing	Timing policy for the probes, or NULL for the default.
+ * @return	Number of LPFKs found (up to max), or LPFK_E_PARAM on bad
+ * 			parameter.
+ * @note	All the ports are probed at the same time, so this takes about as
+ * 			long as lpfk_open() on a single port. The ports are closed again
+ * 			before returning; pass the paths to lpfk_open() to use them.
+ */
+int lpfk_discover(const char *pattern, LPFK_PORT_INFO *found, const int max,
+		const LPFK_TIMING *timing);
+
+/**
+ * @brief	Probe a list of serial ports for LPFKs.
+ * @param	ports	Array of serial port paths.
+ * @param	nports	Number of entries in the ports array.
+ * @param	present	Array of nports ints, set true for each port an LPFK
+ * 					answered on and false for the rest.
+ * @param	timing	Timing policy for the probes, or NULL for the default.
+ * @return	Number of LPFKs found, or LPFK_E_PARAM on bad parameter.
+ * @note	All the ports are probed at the same time. Each port's reset
+ * 			line (RTS) is released for the probe and put back before the
+ * 			port is closed, whether or not an LPFK answered.
+ */
+int lpfk_discover_ports(const char *const *ports, const int nports,
+		int *present, const LPFK_TIMING *timing);
+
+/**
+ * @brief	Fill in an LPFK_OPTIONS struct with the default open options.
+ * @param	opts	Pointer to the LPFK_OPTIONS struct to initialise.
+ */
+void lpfk_default_options(LPFK_OPTIONS *opts);
+
+/**
+ * @brief	Fill in an LPFK_TIMING struct with the default timing policy.
+ * @param	timing	Pointer to the LPFK_TIMING struct to initialise.
+ */
+void lpfk_default_timing(LPFK_TIMING *timing);
+
+/**
+ * @brief	Change the timing policy of an open LPFK.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	timing	New timing policy.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if the policy is invalid or
+ * 			the LPFK was opened with LPFK_OPT_IO_THREAD.
+ * @note	Takes effect from the next command sent to the LPFK.
+ * @note	The I/O thread uses the policy without locking it, so it can't
+ * 			be changed once the thread is running; pass it to lpfk_open_ex()
+ * 			in LPFK_OPTIONS.timing instead.
+ */
+int lpfk_set_timing(LPFK_CTX *ctx, const LPFK_TIMING *timing);
+
+/**
+ * @brief	Get the timing policy of an open LPFK.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	timing	Pointer to an LPFK_TIMING struct to receive the policy.
+ * @return	LPFK_E_OK.
+ */
+int lpfk_get_timing(LPFK_CTX *ctx, LPFK_TIMING *timing);
+
+/**
+ * @brief	Get the traffic and error counters of an open LPFK.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	stats	Pointer to an LPFK_STATS struct to receive the counters.
+ * @return	LPFK_E_OK.
+ * @note	The counters start from zero when the LPFK is opened. They are
+ * 			updated without locking, so a snapshot taken while the I/O
+ * 			thread is running may be a few events out between fields.
+ */
+int lpfk_get_stats(LPFK_CTX *ctx, LPFK_STATS *stats);
+
+/**
+ * @brief	Find out which low latency settings took effect.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_LOWLAT_* flags for the settings in effect; 0 if
+ * 			LPFK_OPT_LOW_LATENCY wasn't asked for, or the port couldn't do
+ * 			either.
+ * @note	The latency timer is in sysfs, and usually needs root to change;
+ * 			ASYNC_LOW_LATENCY doesn't. A pty has neither.
+ */
+int lpfk_get_low_latency(LPFK_CTX *ctx);
+
 /**
  * @brief	Close the LPFK.
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
@@ -92,6 +456,16 @@ int lpfk_open(LPFK_CTX *ctx, const char *port);
  */
 int lpfk_close(LPFK_CTX *ctx);
 
+/**
+ * @brief	Close an LPFK which has stopped responding.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_OK
+ * @note	As lpfk_close(), but without disabling the LPFK and turning its
+ * 			LEDs off first, which would wait for ACKs that will never come.
+ * 			The LPFK is still put back into reset.
+ */
+int lpfk_abandon(LPFK_CTX *ctx);
+
 /**
  * @brief	Enable or disable LPFK input
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
@@ -100,6 +474,26 @@ int lpfk_close(LPFK_CTX *ctx);
  */
 int lpfk_enable(LPFK_CTX *ctx, const int val);
 
+/**
+ * @brief	Queue an enable or disable command, to be sent with the next LED
+ * 			frame or by lpfk_flush().
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	val		true to enable the LPFK's keys, false to disable.
+ * @return	LPFK_E_OK
+ * @note	Only the last command queued is sent, and then only if the LPFK
+ * 			isn't already in that state, so an enable followed by a disable
+ * 			sends nothing at all.
+ */
+int lpfk_enable_cached(LPFK_CTX *ctx, const int val);
+
+/**
+ * @brief	Send everything queued: the enable/disable command from
+ * 			lpfk_enable_cached() and the cached LED mask, in one write.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	As lpfk_update_leds().
+ */
+int lpfk_flush(LPFK_CTX *ctx);
+
 /**
  * @brief	Set or clear an LED in the cached LED mask buffer.
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
@@ -118,14 +512,133 @@ int lpfk_set_led_cached(LPFK_CTX *ctx, const int num, const int state);
  */
 int lpfk_set_leds_cached(LPFK_CTX *ctx, const int state);
 
+/**
+ * @brief	Replace the whole cached LED mask.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	mask	New LED mask; bit n set (LPFK_LED(n)) lights LED n.
+ * @return	LPFK_E_OK
+ */
+int lpfk_set_mask(LPFK_CTX *ctx, const unsigned long mask);
+
+/**
+ * @brief	Get the cached LED mask.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LED mask; bit n set (LPFK_LED(n)) if LED n is lit.
+ */
+unsigned long lpfk_get_mask(LPFK_CTX *ctx);
+
+/**
+ * @brief	Set, clear and toggle several LEDs in the cached LED mask at once.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	set		Mask of LEDs to turn on.
+ * @param	clear	Mask of LEDs to turn off.
+ * @param	toggle	Mask of LEDs to invert.
+ * @return	LPFK_E_OK
+ * @note	The set mask is applied first, then the clear mask, then the
+ * 			toggle mask.
+ */
+int lpfk_modify_leds(LPFK_CTX *ctx, const unsigned long set,
+		const unsigned long clear, const unsigned long toggle);
+
+/**
+ * @brief	Forget what the LPFK's LEDs are showing, so the next LED update
+ * 			is sent even if the mask has not changed.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_OK
+ */
+int lpfk_invalidate_leds(LPFK_CTX *ctx);
+
 /**
  * @brief	Set the LPFK's LED state from the cached LED mask.
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
  * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter, LPFK_E_COMMS
- * 			on comms error.
+ * 			if the LPFK did not acknowledge the update within the number of
+ * 			attempts allowed by the timing policy, or straight away if the
+ * 			port hangs up (e.g. a USB adapter being unplugged).
+ * @note	If the LPFK has already acknowledged the cached LED mask, nothing
+ * 			is sent and LPFK_E_OK is returned straight away.
+ * @note	With LPFK_OPT_IO_THREAD, the update is queued for the I/O thread
+ * 			and this returns LPFK_E_OK straight away (or LPFK_E_BUSY if the
+ * 			queue is full). Use lpfk_update_status() to find out how it went.
  */
 int lpfk_update_leds(LPFK_CTX *ctx);
 
+/**
+ * @brief	Send the cached LED mask to the LPFK; safe to call from several
+ * 			threads at once.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_OK if the mask was handed to the I/O thread; LPFK_E_PARAM
+ * 			if there is no I/O thread and this isn't the thread which opened
+ * 			the LPFK; otherwise as lpfk_update_leds().
+ * @note	With LPFK_OPT_IO_THREAD, this asks the I/O thread to send the
+ * 			mask and returns straight away. If a frame is already under way,
+ * 			the mask goes out once the LPFK has acknowledged it, so any
+ * 			number of changes made during one frame go out together in the
+ * 			next. Each frame is a consistent snapshot of the mask.
+ * @note	Without an I/O thread, sending means running the receive path
+ * 			(keys, ACKs, local echo) on the calling thread, so only the
+ * 			thread which opened the LPFK may do it; this is then the same as
+ * 			lpfk_update_leds().
+ * @note	The cached mask functions (lpfk_set_led_cached(),
+ * 			lpfk_modify_leds() and so on) are safe to call from any thread.
+ */
+int lpfk_flush_leds(LPFK_CTX *ctx);
+
+/**
+ * @brief	Find out how the most recent lpfk_flush_leds() went.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_BUSY if the I/O thread hasn't finished sending the mask,
+ * 			LPFK_E_OK if the LPFK acknowledged it, LPFK_E_COMMS if it did
+ * 			not.
+ * @note	Flushes requested while a frame is under way are sent together,
+ * 			so this answers for all of them at once. With
+ * 			LPFK_OPT_IO_THREAD, safe to call from any thread.
+ */
+int lpfk_flush_status(LPFK_CTX *ctx);
+
+/**
+ * @brief	Start setting the LPFK's LED state from the cached LED mask,
+ * 			without waiting for the LPFK to acknowledge it.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	cb		Function to call when the update completes, or NULL.
+ * @param	user	User data pointer passed to the callback.
+ * @return	LPFK_E_OK if the update was started, LPFK_E_BUSY if another
+ * 			update is still in progress, LPFK_E_PARAM if a callback was given
+ * 			and the LPFK was opened with LPFK_OPT_IO_THREAD.
+ * @note	The update is driven by lpfk_read() and lpfk_process(). Call one
+ * 			of them whenever the descriptor from lpfk_get_fd() is readable,
+ * 			or lpfk_get_timeout() milliseconds have passed, until the
+ * 			callback has been called or lpfk_update_status() no longer
+ * 			returns LPFK_E_BUSY. Retransmit requests and ACK timeouts are
+ * 			handled internally. If the LPFK has already acknowledged the
+ * 			cached LED mask, the callback is called before this returns.
+ */
+int lpfk_update_leds_async(LPFK_CTX *ctx, LPFK_UPDATE_CB cb, void *user);
+
+/**
+ * @brief	Get the status of the most recent LED update.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_BUSY if the update is still in progress, LPFK_E_OK if the
+ * 			LPFK acknowledged it, LPFK_E_COMMS if it did not.
+ */
+int lpfk_update_status(LPFK_CTX *ctx);
+
+/**
+ * @brief	Service pending LPFK protocol operations without blocking.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_OK on success.
+ * @note	Keycodes received while doing so are buffered for lpfk_read().
+ */
+int lpfk_process(LPFK_CTX *ctx);
+
+/**
+ * @brief	Get the time until the next protocol timeout.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	Milliseconds until lpfk_process() must next be called, or -1 if
+ * 			no operation is pending. Suitable for passing to poll().
+ */
+int lpfk_get_timeout(LPFK_CTX *ctx);
+
 /**
  * @brief	Set or clear an LED on the LPFK.
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
@@ -161,7 +674,79 @@ int lpfk_get_led(LPFK_CTX *ctx, const int num);
  * @brief	Read a key from the LPFK
  * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
  * @return	LPFK_E_NO_KEYS if no keys in buffer, 0-31 for key 1-32 down.
+ * @note	With LPFK_OPT_IO_THREAD this is a wait-free pop from the I/O
+ * 			thread's key queue, and only makes a system call when the queue
+ * 			has been emptied.
  */
 int lpfk_read(LPFK_CTX *ctx);
 
+/**
+ * @brief	Read all the buffered keys from the LPFK
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	events	Array to receive the key events, oldest first.
+ * @param	max		Number of entries in the events array.
+ * @return	Number of key events read (0 if none were buffered),
+ * 			LPFK_E_NOT_ENABLED if the LPFK is disabled, LPFK_E_PARAM on bad
+ * 			parameter.
+ * @note	Each event is stamped with the time it was read from the serial
+ * 			port, so the time between then and the call to this function is
+ * 			the time it spent waiting in the library.
+ */
+int lpfk_read_batch(LPFK_CTX *ctx, LPFK_KEY_EVENT *events, const int max);
+
+/**
+ * @brief	Wait for a key to be pressed on the LPFK
+ * @param	ctx			Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	timeout_ms	Maximum time to wait in milliseconds. Zero returns
+ * 						immediately, a negative value waits forever.
+ * @return	LPFK_E_NO_KEYS if the timeout expired, LPFK_E_NOT_ENABLED if the
+ * 			LPFK is disabled, LPFK_E_COMMS on comms error, 0-31 for key 1-32
+ * 			down.
+ * @note	The calling thread sleeps in the kernel while waiting; no CPU time
+ * 			is used until a byte arrives, the timeout expires, or an LED
+ * 			update or momentary echo needs attention. Echoes are turned
+ * 			off on time, and lost echo frames resent, while it waits.
+ */
+int lpfk_wait_key(LPFK_CTX *ctx, const int timeout_ms);
+
+/**
+ * @brief	Set how the LPFK's LED responds when its key is pressed.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	key		Key number, from 0 to 31.
+ * @param	mode	LPFK_ECHO_NONE, LPFK_ECHO_TOGGLE, LPFK_ECHO_MOMENTARY or
+ * 					LPFK_ECHO_RADIO.
+ * @param	param	For LPFK_ECHO_MOMENTARY, how long to light the LED for,
+ * 					in milliseconds. For LPFK_ECHO_RADIO, the group number:
+ * 					pressing a key lights its LED and turns off the LEDs of
+ * 					the other keys in the same group. Otherwise ignored.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter.
+ * @note	The library changes the cached LED mask and sends it as soon as
+ * 			the keycode arrives, without waiting for the application to read
+ * 			the key, which is still queued for lpfk_read() as usual. A key
+ * 			which is dropped, because the queue is full or the LPFK is
+ * 			disabled, is not echoed.
+ * @note	Momentary echoes are turned off by lpfk_process(), so keep
+ * 			calling it when lpfk_get_timeout() expires. lpfk_wait_key()
+ * 			does this while it waits, and the I/O thread does it for
+ * 			itself.
+ */
+int lpfk_set_echo(LPFK_CTX *ctx, const int key, const int mode, const int param);
+
+/**
+ * @brief	Get the file descriptor used to talk to the LPFK
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	File descriptor which becomes readable (POLLIN) when the LPFK has
+ * 			sent data. Call lpfk_read() until it returns LPFK_E_NO_KEYS when
+ * 			it does.
+ * @note	The descriptor may be added to a poll(), select() or epoll set,
+ * 			but must not be read from, written to or closed by the caller.
+ * 			With LPFK_OPT_IO_THREAD this is an eventfd signalled by the I/O
+ * 			thread when it queues a key.
+ * @note	Without LPFK_OPT_IO_THREAD, this is -1 for a transport with no
+ * 			descriptor, such as the simulator's loopback; lpfk_get_timeout()
+ * 			counts down to the LPFK's next bytes instead, and is 0 while
+ * 			there are some waiting.
+ */
+int lpfk_get_fd(LPFK_CTX *ctx);
+
 #endif // _liblpfk_h_included
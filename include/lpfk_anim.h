@@ -0,0 +1,182 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_anim.h
+ * @brief	liblpfk LED animation engine
+ *
+ * Plays a sequence of LED masks, or masks made by a generator callback, at
+ * a fixed frame rate. Frames are timed by a timerfd with absolute deadlines
+ * on multiples of the frame period since the epoch, so the animation
+ * doesn't drift however long the ACKs take, and LPFKs on different machines
+ * with synchronised clocks show the same frame at the same time. Frames
+ * which can't be shown on time are dropped rather than queued.
+ */
+
+#ifndef _lpfk_anim_h_included
+#define _lpfk_anim_h_included
+
+#include "liblpfk.h"
+
+typedef struct lpfk_anim LPFK_ANIM;
+
+/**
+ * @brief	Frame generator callback
+ * @param	anim	Animation which wants a frame.
+ * @param	frame	Frame number: the number of frame periods since the
+ * 					epoch (1970-01-01 00:00:00 UTC).
+ * @param	mask	Pointer to receive the frame's LED mask; bit n set
+ * 					(LPFK_LED(n)) lights LED n.
+ * @param	user	User data pointer passed to lpfk_anim_set_generator().
+ * @return	true to show the frame, false to end the animation.
+ */
+typedef int (*LPFK_ANIM_GEN)(LPFK_ANIM *anim, const unsigned long long frame,
+		unsigned long *mask, void *user);
+
+/**
+ * @brief	LED animation
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+struct lpfk_anim {
+	LPFK_CTX			*ctx;		///< LPFK to animate
+	int					tfd;		///< frame timer
+	long long			period_ns;	///< frame period
+	const unsigned long	*seq;		///< precomputed frames, or NULL
+	int					nframes;	///< number of precomputed frames
+	int					loop;		///< loop the precomputed frames
+	LPFK_ANIM_GEN		gen;		///< frame generator, or NULL
+	void				*gen_user;	///< frame generator user data
+	int					running;	///< animation running
+	unsigned long long	start_frame;	///< frame number of the first frame
+	unsigned long long	frame;		///< frame number of the current frame
+	unsigned long		shown;		///< frames sent to the LPFK
+	unsigned long		dropped;	///< frames dropped for being late
+};
+
+/**
+ * @brief	Set up an animation.
+ * @param	anim		Pointer to an LPFK_ANIM struct to initialise.
+ * @param	ctx			Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @param	period_ms	Frame period in milliseconds.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter,
+ * 			LPFK_E_COMMS if the timer could not be created.
+ */
+int lpfk_anim_init(LPFK_ANIM *anim, LPFK_CTX *ctx, const int period_ms);
+
+/**
+ * @brief	Free an animation's resources.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	LPFK_E_OK
+ */
+int lpfk_anim_close(LPFK_ANIM *anim);
+
+/**
+ * @brief	Play a precomputed sequence of LED masks.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @param	masks	LED masks, one per frame. Must stay valid while the
+ * 					animation is playing.
+ * @param	n		Number of frames.
+ * @param	loop	true to repeat the sequence forever, false to play it once.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter.
+ * @note	A looping sequence is locked to the wall clock, not to the time
+ * 			it was started: frame n of the sequence is shown when the frame
+ * 			number modulo the sequence length is n. A sequence played once
+ * 			starts from its first frame.
+ */
+int lpfk_anim_set_sequence(LPFK_ANIM *anim, const unsigned long *masks,
+		const int n, const int loop);
+
+/**
+ * @brief	Generate frames with a callback.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @param	gen		Frame generator.
+ * @param	user	User data pointer passed to the generator.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter.
+ */
+int lpfk_anim_set_generator(LPFK_ANIM *anim, LPFK_ANIM_GEN gen, void *user);
+
+/**
+ * @brief	Start playing the animation at the next frame boundary.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if there are no frames to
+ * 			play, LPFK_E_COMMS if the timer could not be set.
+ */
+int lpfk_anim_start(LPFK_ANIM *anim);
+
+/**
+ * @brief	Stop playing the animation. The LEDs are left as they are.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	LPFK_E_OK
+ */
+int lpfk_anim_stop(LPFK_ANIM *anim);
+
+/**
+ * @brief	Get the animation's frame timer descriptor.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	File descriptor which becomes readable (POLLIN) when the next
+ * 			frame is due. Call lpfk_anim_process() when it does.
+ */
+int lpfk_anim_get_fd(LPFK_ANIM *anim);
+
+/**
+ * @brief	Show the frame which is due, if any.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	true if the animation is still playing, false if it has ended
+ * 			or been stopped.
+ * @note	Frames are sent with lpfk_update_leds_async(), so the LPFK's
+ * 			descriptor must be serviced with lpfk_process() as usual. If
+ * 			the previous frame hasn't been acknowledged by the time the next
+ * 			one is due, or more than one period has passed since the last
+ * 			call, the frames which missed their slot are dropped.
+ */
+int lpfk_anim_process(LPFK_ANIM *anim);
+
+/**
+ * @brief	Play the animation until it ends, servicing the LPFK meanwhile.
+ * @param	anim	Pointer to an LPFK_ANIM initialised by lpfk_anim_init().
+ * @return	LPFK_E_OK when the animation ends, LPFK_E_COMMS on error.
+ * @note	Keys pressed while the animation is playing stay in the queue
+ * 			for lpfk_read().
+ */
+int lpfk_anim_run(LPFK_ANIM *anim);
+
+#endif // _lpfk_anim_h_included
@@ -0,0 +1,175 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_client.h
+ * @brief	liblpfk client for the lpfkd daemon
+ *
+ * Only one process can have the LPFK's serial port open. lpfkd owns it and
+ * shares the LPFK out over a Unix domain socket: each client gets its own
+ * compositor layer for the LEDs, and a copy of the keypresses it has
+ * subscribed to. Connecting is a socket() and a connect(), not a two
+ * second wait for the LPFK to come out of reset, and each LED change is
+ * one message; lpfkd merges every client's changes into at most one LED
+ * frame per tick.
+ *
+ * The protocol is a stream of fixed size LPFKD_MSG datagrams on a
+ * SOCK_SEQPACKET socket, in host byte order.
+ */
+
+#ifndef _lpfk_client_h_included
+#define _lpfk_client_h_included
+
+#include <stdint.h>
+#include "liblpfk.h"
+
+/// Socket lpfkd listens on by default
+#define LPFKD_DEFAULT_SOCKET	"/run/lpfkd.sock"
+
+/**
+ * @brief	lpfkd message types, for LPFKD_MSG.op
+ */
+enum {
+	/// Client to lpfkd: send me these keys. mask = keys wanted, replacing
+	/// any earlier subscription; 0 to unsubscribe.
+	LPFKD_OP_SUBSCRIBE = 1,
+	/// Client to lpfkd: take control of the LEDs in mask, and set them
+	/// from value. Those of them in blink blink while lit.
+	LPFKD_OP_SET,
+	/// Client to lpfkd: hand the LEDs in mask back to other clients.
+	LPFKD_OP_RELEASE,
+	/// lpfkd to client: key number key was pressed.
+	LPFKD_OP_KEY
+};
+
+/**
+ * @brief	lpfkd protocol message
+ */
+typedef struct {
+	uint8_t		op;			///< LPFKD_OP_*
+	uint8_t		key;		///< key number (LPFKD_OP_KEY)
+	uint16_t	reserved;	///< set to zero
+	uint32_t	mask;		///< key or LED mask; bit n for key/LED n
+	uint32_t	value;		///< LED states (LPFKD_OP_SET)
+	uint32_t	blink;		///< blinking LEDs (LPFKD_OP_SET)
+} LPFKD_MSG;
+
+/**
+ * @brief	lpfkd client connection
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+typedef struct {
+	int				fd;			///< socket connected to lpfkd
+} LPFK_CLIENT;
+
+/**
+ * @brief	Connect to lpfkd.
+ * @param	cl		Pointer to an LPFK_CLIENT struct to initialise.
+ * @param	path	Path of lpfkd's socket, or NULL for LPFKD_DEFAULT_SOCKET.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if the path is too long,
+ * 			LPFK_E_NOT_PRESENT if lpfkd isn't listening on it.
+ */
+int lpfk_client_open(LPFK_CLIENT *cl, const char *path);
+
+/**
+ * @brief	Disconnect from lpfkd. Any LEDs the client controls are handed
+ * 			back to the other clients.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @return	LPFK_E_OK
+ */
+int lpfk_client_close(LPFK_CLIENT *cl);
+
+/**
+ * @brief	Choose which keypresses lpfkd sends this client.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @param	keys	Key mask; bit n set (LPFK_LED(n)) for key n. 0 for none.
+ * @return	LPFK_E_OK on success, LPFK_E_BUSY if lpfkd is behind and the
+ * 			message couldn't be queued (try again later), LPFK_E_COMMS if
+ * 			lpfkd has gone away.
+ */
+int lpfk_client_subscribe(LPFK_CLIENT *cl, const unsigned long keys);
+
+/**
+ * @brief	Set some LEDs.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @param	mask	LEDs to change; the client takes control of them.
+ * @param	value	New state of the LEDs in mask.
+ * @param	blink	Which of the LEDs in mask blink when lit.
+ * @return	LPFK_E_OK on success, LPFK_E_BUSY if lpfkd is behind and the
+ * 			message couldn't be queued (try again later), LPFK_E_COMMS if
+ * 			lpfkd has gone away.
+ * @note	Where two clients control the same LED, the one which
+ * 			connected first wins.
+ */
+int lpfk_client_set(LPFK_CLIENT *cl, const unsigned long mask,
+		const unsigned long value, const unsigned long blink);
+
+/**
+ * @brief	Hand some LEDs back to the other clients.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @param	mask	LEDs to release.
+ * @return	LPFK_E_OK on success, LPFK_E_BUSY if lpfkd is behind and the
+ * 			message couldn't be queued (try again later), LPFK_E_COMMS if
+ * 			lpfkd has gone away.
+ */
+int lpfk_client_release(LPFK_CLIENT *cl, const unsigned long mask);
+
+/**
+ * @brief	Read a keypress sent by lpfkd.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @return	LPFK_E_NO_KEYS if no keys are waiting, LPFK_E_COMMS if lpfkd
+ * 			has gone away, 0-31 for key 1-32 down.
+ * @note	Never blocks; poll the descriptor from lpfk_client_get_fd() for
+ * 			POLLIN to wait for a key.
+ */
+int lpfk_client_read(LPFK_CLIENT *cl);
+
+/**
+ * @brief	Get the socket connected to lpfkd.
+ * @param	cl		Pointer to an LPFK_CLIENT initialised by lpfk_client_open().
+ * @return	File descriptor which becomes readable (POLLIN) when lpfkd has
+ * 			sent a key. It must not be read from, written to or closed by
+ * 			the caller.
+ */
+int lpfk_client_get_fd(LPFK_CLIENT *cl);
+
+#endif // _lpfk_client_h_included
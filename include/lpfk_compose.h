@@ -0,0 +1,175 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_compose.h
+ * @brief	liblpfk layered LED compositor
+ *
+ * Lets several parts of an application share the LPFK's LEDs without
+ * fighting over them. Each producer gets a layer with a priority, and sets
+ * the LEDs it cares about on that layer; where layers overlap, the one with
+ * the highest priority wins. Layers can make LEDs blink.
+ *
+ * The compositor is an LPFK_ANIM frame generator: the animation engine
+ * composites the layers once per frame and sends the result, so however
+ * many producers change their layers, the LPFK gets at most one frame per
+ * tick -- and none at all if nothing visible has changed.
+ */
+
+#ifndef _lpfk_compose_h_included
+#define _lpfk_compose_h_included
+
+#include <pthread.h>
+#include "liblpfk.h"
+#include "lpfk_anim.h"
+
+/// Maximum number of layers in a compositor
+#define LPFK_COMPOSE_MAX_LAYERS	16
+
+/**
+ * @brief	Compositor layer
+ */
+typedef struct {
+	int				used;		///< layer allocated
+	int				priority;	///< higher priorities cover lower ones
+	unsigned long	mask;		///< LEDs this layer controls
+	unsigned long	value;		///< state of the LEDs this layer controls
+	unsigned long	blink;		///< LEDs which blink when lit
+} LPFK_LAYER;
+
+/**
+ * @brief	Layered LED compositor
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+typedef struct {
+	pthread_mutex_t	lock;		///< protects the layers
+	LPFK_LAYER		layers[LPFK_COMPOSE_MAX_LAYERS];	///< layers
+	int				order[LPFK_COMPOSE_MAX_LAYERS];	///< used layers, highest priority first
+	int				nlayers;	///< number of used layers
+	int				blink_frames;	///< length of each blink phase, in frames
+} LPFK_COMPOSITOR;
+
+/**
+ * @brief	Set up a compositor with no layers.
+ * @param	comp			Pointer to an LPFK_COMPOSITOR struct to initialise.
+ * @param	blink_frames	Number of frames blinking LEDs spend on, then off.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter.
+ */
+int lpfk_compose_init(LPFK_COMPOSITOR *comp, const int blink_frames);
+
+/**
+ * @brief	Free a compositor's resources.
+ * @param	comp	Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @return	LPFK_E_OK
+ */
+int lpfk_compose_close(LPFK_COMPOSITOR *comp);
+
+/**
+ * @brief	Add a layer. It starts out controlling no LEDs.
+ * @param	comp		Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @param	priority	Layer priority. Where layers overlap, the highest
+ * 						priority wins; between equal priorities, the layer
+ * 						added first wins.
+ * @return	Layer ID (0 or more) on success, LPFK_E_BUSY if there are
+ * 			already LPFK_COMPOSE_MAX_LAYERS layers.
+ */
+int lpfk_compose_add_layer(LPFK_COMPOSITOR *comp, const int priority);
+
+/**
+ * @brief	Remove a layer, handing its LEDs back to the layers below.
+ * @param	comp	Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @param	layer	Layer ID from lpfk_compose_add_layer().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad layer ID.
+ */
+int lpfk_compose_remove_layer(LPFK_COMPOSITOR *comp, const int layer);
+
+/**
+ * @brief	Set some of a layer's LEDs.
+ * @param	comp	Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @param	layer	Layer ID from lpfk_compose_add_layer().
+ * @param	mask	LEDs to change; bit n set (LPFK_LED(n)) for LED n. The
+ * 					layer takes control of these LEDs.
+ * @param	value	New state of the LEDs in mask; other bits are ignored.
+ * @param	blink	Which of the LEDs in mask blink when lit; other bits
+ * 					are ignored.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad layer ID.
+ * @note	May be called from any thread.
+ */
+int lpfk_compose_set(LPFK_COMPOSITOR *comp, const int layer,
+		const unsigned long mask, const unsigned long value,
+		const unsigned long blink);
+
+/**
+ * @brief	Hand some of a layer's LEDs back to the layers below.
+ * @param	comp	Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @param	layer	Layer ID from lpfk_compose_add_layer().
+ * @param	mask	LEDs to release.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad layer ID.
+ * @note	May be called from any thread.
+ */
+int lpfk_compose_release(LPFK_COMPOSITOR *comp, const int layer,
+		const unsigned long mask);
+
+/**
+ * @brief	Composite the layers.
+ * @param	comp	Pointer to an LPFK_COMPOSITOR initialised by lpfk_compose_init().
+ * @param	frame	Frame number, which sets the blink phase: blinking LEDs
+ * 					are lit in frames where (frame / blink_frames) is even.
+ * @return	LED mask; bit n set (LPFK_LED(n)) if LED n should be lit.
+ */
+unsigned long lpfk_compose_mask(LPFK_COMPOSITOR *comp,
+		const unsigned long long frame);
+
+/**
+ * @brief	LPFK_ANIM frame generator which shows the composited layers.
+ * @param	anim	Animation which wants a frame.
+ * @param	frame	Frame number.
+ * @param	mask	Pointer to receive the frame's LED mask.
+ * @param	user	Pointer to the LPFK_COMPOSITOR.
+ * @return	true; the compositor never ends the animation.
+ * @note	Pass to lpfk_anim_set_generator() with the compositor as the
+ * 			user data pointer.
+ */
+int lpfk_compose_generator(LPFK_ANIM *anim, const unsigned long long frame,
+		unsigned long *mask, void *user);
+
+#endif // _lpfk_compose_h_included
@@ -0,0 +1,135 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_dither.h
+ * @brief	liblpfk LED brightness by temporal dithering
+ *
+ * The LPFK's LEDs are either on or off, but by switching them fast enough
+ * they can be given any of LPFK_DITHER_MAX + 1 brightness levels. Each LED
+ * has a sigma-delta modulator which decides whether it's lit in each frame,
+ * so over any run of frames it's lit for as close to level / LPFK_DITHER_MAX
+ * of them as possible. Frames are sent back to back: each one goes out as
+ * soon as the LPFK acknowledges the last, so the line runs at full speed
+ * and there is never more than one frame in flight.
+ */
+
+#ifndef _lpfk_dither_h_included
+#define _lpfk_dither_h_included
+
+#include "liblpfk.h"
+
+/// Brightness level of a fully lit LED
+#define LPFK_DITHER_MAX		255
+
+/**
+ * @brief	LED dithering state
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+typedef struct {
+	LPFK_CTX		*ctx;			///< LPFK being driven
+	unsigned char	level[32];		///< brightness level of each LED
+	unsigned int	acc[32];		///< sigma-delta accumulator of each LED
+	int				running;		///< dithering running
+	int				in_flight;		///< a frame is waiting to be acknowledged
+	unsigned long	frames;			///< frames acknowledged
+	unsigned long	errors;			///< frames the LPFK never acknowledged
+} LPFK_DITHER;
+
+/**
+ * @brief	Set up LED dithering on an LPFK. All LEDs start off.
+ * @param	dither	Pointer to an LPFK_DITHER struct to initialise.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if the LPFK was opened with
+ * 			LPFK_OPT_IO_THREAD.
+ */
+int lpfk_dither_init(LPFK_DITHER *dither, LPFK_CTX *ctx);
+
+/**
+ * @brief	Set the brightness of one LED.
+ * @param	dither	Pointer to an LPFK_DITHER initialised by lpfk_dither_init().
+ * @param	led		LED number, 0 to 31.
+ * @param	level	Brightness, 0 (off) to LPFK_DITHER_MAX (fully on).
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter.
+ */
+int lpfk_dither_set_level(LPFK_DITHER *dither, const int led, const int level);
+
+/**
+ * @brief	Set the brightness of every LED.
+ * @param	dither	Pointer to an LPFK_DITHER initialised by lpfk_dither_init().
+ * @param	levels	Brightness of LEDs 0 to 31, 0 to LPFK_DITHER_MAX each.
+ * @return	LPFK_E_OK
+ */
+int lpfk_dither_set_levels(LPFK_DITHER *dither, const unsigned char *levels);
+
+/**
+ * @brief	Get the brightness of one LED.
+ * @param	dither	Pointer to an LPFK_DITHER initialised by lpfk_dither_init().
+ * @param	led		LED number, 0 to 31.
+ * @return	Brightness level, or LPFK_E_PARAM on bad parameter.
+ */
+int lpfk_dither_get_level(LPFK_DITHER *dither, const int led);
+
+/**
+ * @brief	Start dithering.
+ * @param	dither	Pointer to an LPFK_DITHER initialised by lpfk_dither_init().
+ * @return	LPFK_E_OK on success, LPFK_E_BUSY if another LED update is
+ * 			in progress.
+ * @note	Frames are driven by lpfk_process(); call it (or lpfk_read())
+ * 			whenever the descriptor from lpfk_get_fd() is readable or
+ * 			lpfk_get_timeout() expires, as for lpfk_update_leds_async(). Don't
+ * 			start any other LED updates while dithering. Dithering stops by
+ * 			itself if a frame is never acknowledged, even after retrying.
+ */
+int lpfk_dither_start(LPFK_DITHER *dither);
+
+/**
+ * @brief	Stop dithering once the frame in flight has been acknowledged.
+ * @param	dither	Pointer to an LPFK_DITHER initialised by lpfk_dither_init().
+ * @return	LPFK_E_OK
+ * @note	The LEDs are left showing the last frame. lpfk_update_leds()
+ * 			waits for the frame in flight, so it can be called straight
+ * 			afterwards.
+ */
+int lpfk_dither_stop(LPFK_DITHER *dither);
+
+#endif // _lpfk_dither_h_included
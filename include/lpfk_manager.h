@@ -0,0 +1,214 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_manager.h
+ * @brief	liblpfk multi-device manager
+ *
+ * The manager owns any number of LPFK contexts and services all of them
+ * from a single epoll-based event loop. Key presses are passed to the
+ * application with the ID of the LPFK they came from, and LED updates are
+ * sent asynchronously, so a slow or unresponsive LPFK never holds up the
+ * others.
+ */
+
+#ifndef _lpfk_manager_h_included
+#define _lpfk_manager_h_included
+
+#include "liblpfk.h"
+
+typedef struct lpfk_manager LPFK_MANAGER;
+
+/**
+ * @brief	Key event callback
+ * @param	mgr		Manager the event came from.
+ * @param	dev		Device ID, as returned by lpfk_manager_add().
+ * @param	key		0-31 for key 1-32 down, or LPFK_E_COMMS if the LPFK has
+ * 					stopped responding and has been dropped from the loop.
+ * @param	user	User data pointer passed to lpfk_manager_set_key_cb().
+ */
+typedef void (*LPFK_MGR_KEY_CB)(LPFK_MANAGER *mgr, const int dev,
+		const int key, void *user);
+
+/**
+ * @brief	LED update completion callback
+ * @param	mgr		Manager the event came from.
+ * @param	dev		Device ID, as returned by lpfk_manager_add().
+ * @param	result	LPFK_E_OK if the LPFK acknowledged the new LED state,
+ * 					LPFK_E_COMMS if it did not.
+ * @param	user	User data pointer passed to lpfk_manager_set_led_cb().
+ */
+typedef void (*LPFK_MGR_LED_CB)(LPFK_MANAGER *mgr, const int dev,
+		const int result, void *user);
+
+/**
+ * @brief	Multi-device manager
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+struct lpfk_manager {
+	int					epfd;		///< epoll file descriptor
+	struct lpfk_mgr_dev	**devs;		///< devices, indexed by ID
+	int					ndevs;		///< number of entries in devs
+	LPFK_MGR_KEY_CB		key_cb;		///< key event callback
+	void				*key_user;	///< key event callback user data
+	LPFK_MGR_LED_CB		led_cb;		///< LED update callback
+	void				*led_user;	///< LED update callback user data
+	int					running;	///< inside lpfk_manager_run()
+	struct lpfk_mgr_dev	*removed;	///< devices removed during this run
+};
+
+/**
+ * @brief	Initialise a multi-device manager.
+ * @param	mgr		Pointer to an LPFK_MANAGER struct to initialise.
+ * @return	LPFK_E_OK on success, LPFK_E_COMMS if the event loop could not
+ * 			be created.
+ */
+int lpfk_manager_init(LPFK_MANAGER *mgr);
+
+/**
+ * @brief	Close all the LPFKs owned by a manager and free its resources.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @return	LPFK_E_OK
+ */
+int lpfk_manager_close(LPFK_MANAGER *mgr);
+
+/**
+ * @brief	Open an LPFK and add it to a manager.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	port	Serial port path (e.g. /dev/ttyS0).
+ * @param	opts	Open options, or NULL for the defaults.
+ * @return	Device ID (0 or greater) on success, LPFK_E_PARAM if opts asks
+ * 			for LPFK_OPT_IO_THREAD, LPFK_E_BUSY if called from a manager
+ * 			callback, or any error code returned by lpfk_open_ex().
+ * @note	Blocks while lpfk_open_ex() looks for the LPFK, for up to the
+ * 			open timeout in opts. No managed device is serviced meanwhile,
+ * 			so this can't be called from inside lpfk_manager_run(); add new
+ * 			devices between calls to it.
+ * @note	The manager's event loop does the I/O thread's job, so the
+ * 			managed contexts can't have one.
+ */
+int lpfk_manager_add(LPFK_MANAGER *mgr, const char *port,
+		const LPFK_OPTIONS *opts);
+
+/**
+ * @brief	Close an LPFK and remove it from a manager.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	dev		Device ID, as returned by lpfk_manager_add().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if there is no such device.
+ * @note	A device which has stopped responding is closed with
+ * 			lpfk_abandon(), so removing it doesn't wait for ACKs.
+ */
+int lpfk_manager_remove(LPFK_MANAGER *mgr, const int dev);
+
+/**
+ * @brief	Get the LPFK context of a managed device.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	dev		Device ID, as returned by lpfk_manager_add().
+ * @return	Pointer to the device's context, or NULL if there is no such
+ * 			device.
+ * @note	The context may be used to enable the LPFK and change its cached
+ * 			LED state. Use lpfk_manager_update_leds() rather than
+ * 			lpfk_update_leds() to send the LED state, and do not read keys
+ * 			from it directly.
+ */
+LPFK_CTX *lpfk_manager_ctx(LPFK_MANAGER *mgr, const int dev);
+
+/**
+ * @brief	Schedule an LED update for a managed device.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	dev		Device ID, as returned by lpfk_manager_add().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if there is no such device,
+ * 			or the error from lpfk_update_leds_async() if the update could
+ * 			not be started.
+ * @note	Never blocks. If an update is already in progress on the device,
+ * 			the cached LED state is sent again once it completes; several
+ * 			updates scheduled in the meantime are merged into one.
+ */
+int lpfk_manager_update_leds(LPFK_MANAGER *mgr, const int dev);
+
+/**
+ * @brief	Set the key event callback.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	cb		Callback function, or NULL.
+ * @param	user	User data pointer passed to the callback.
+ */
+void lpfk_manager_set_key_cb(LPFK_MANAGER *mgr, LPFK_MGR_KEY_CB cb, void *user);
+
+/**
+ * @brief	Set the LED update completion callback.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @param	cb		Callback function, or NULL.
+ * @param	user	User data pointer passed to the callback.
+ */
+void lpfk_manager_set_led_cb(LPFK_MANAGER *mgr, LPFK_MGR_LED_CB cb, void *user);
+
+/**
+ * @brief	Run one iteration of the manager's event loop.
+ * @param	mgr			Pointer to an LPFK_MANAGER initialised by
+ * 						lpfk_manager_init().
+ * @param	timeout_ms	Maximum time to wait for an event in milliseconds.
+ * 						Zero returns immediately, a negative value waits
+ * 						until something happens.
+ * @return	LPFK_E_OK on success, LPFK_E_COMMS if the event loop failed.
+ * @note	Callbacks are called from inside this function.
+ */
+int lpfk_manager_run(LPFK_MANAGER *mgr, const int timeout_ms);
+
+/**
+ * @brief	Get the manager's event loop file descriptor.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @return	File descriptor which becomes readable when any managed LPFK
+ * 			needs servicing, for nesting the manager inside another event
+ * 			loop. Call lpfk_manager_run(mgr, 0) when it does, and also after
+ * 			lpfk_manager_get_timeout() milliseconds.
+ */
+int lpfk_manager_get_fd(LPFK_MANAGER *mgr);
+
+/**
+ * @brief	Get the time until the manager next needs servicing.
+ * @param	mgr		Pointer to an LPFK_MANAGER initialised by lpfk_manager_init().
+ * @return	Milliseconds until the next protocol timeout on any managed
+ * 			LPFK, or -1 if none are pending.
+ */
+int lpfk_manager_get_timeout(LPFK_MANAGER *mgr);
+
+#endif // _lpfk_manager_h_included
@@ -0,0 +1,204 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_shm.h
+ * @brief	liblpfk shared-memory LED framebuffer
+ *
+ * Puts the LED mask in a named POSIX shared memory segment, so any process
+ * on the machine can change the LEDs with an atomic operation on a shared
+ * word: no messages, and usually no system calls at all. The process which
+ * owns the LPFK runs a flusher thread which copies the segment's mask to
+ * the LPFK.
+ *
+ * The flusher sleeps on a futex in the segment when there is nothing to do.
+ * A writer only makes the wake-up system call if it finds the flusher
+ * asleep, so while the flusher is busy sending a frame, any number of
+ * changes cost nothing but the atomic operation, and all go out together
+ * in the next frame.
+ *
+ * The flusher reports what it last sent in a status block guarded by a
+ * seqlock, which any process can read without blocking the flusher.
+ */
+
+#ifndef _lpfk_shm_h_included
+#define _lpfk_shm_h_included
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "liblpfk.h"
+
+/// LPFK_SHM_SEG.magic value: "LPFK"
+#define LPFK_SHM_MAGIC		0x4B46504CU
+
+/**
+ * @brief	Shared memory segment layout
+ *
+ * All fields are accessed with atomic operations.
+ */
+typedef struct {
+	uint32_t	magic;		///< LPFK_SHM_MAGIC once the segment is set up
+	uint32_t	mask;		///< LED mask; bit n set (LPFK_LED(n)) lights LED n
+	uint32_t	gen;		///< mask change count, and the flusher's futex
+	uint32_t	waiting;	///< flusher is asleep on gen
+
+	// status block, written by the flusher
+	uint32_t	seq;		///< status seqlock; odd while being written
+	uint32_t	shown;		///< last mask sent to the LPFK
+	int32_t		result;		///< whether the LPFK acknowledged it, as lpfk_flush_status()
+	uint32_t	reserved;	///< padding
+	uint64_t	flushes;	///< number of times the flusher has sent the mask
+	uint64_t	time_ns;	///< CLOCK_MONOTONIC time of the last flush
+} LPFK_SHM_SEG;
+
+/**
+ * @brief	Flusher status, returned by lpfk_shm_get_status().
+ */
+typedef struct {
+	unsigned long		shown;		///< last mask sent to the LPFK
+	int					result;		///< whether the LPFK acknowledged it, as lpfk_flush_status()
+	unsigned long long	flushes;	///< number of times the flusher has sent the mask
+	long long			time_ns;	///< CLOCK_MONOTONIC time of the last flush
+} LPFK_SHM_STATUS;
+
+/**
+ * @brief	Shared-memory LED framebuffer handle
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+typedef struct {
+	LPFK_SHM_SEG	*seg;		///< mapped segment
+	LPFK_CTX		*ctx;		///< LPFK being driven, NULL if only attached
+	char			name[LPFK_PATH_MAX];	///< segment name
+	pthread_t		thread;		///< flusher thread
+	int				stop;		///< flusher thread asked to stop
+} LPFK_SHM;
+
+/**
+ * @brief	Create a shared-memory framebuffer and start flushing it to an
+ * 			LPFK.
+ * @param	shm		Pointer to an LPFK_SHM struct to initialise.
+ * @param	ctx		Pointer to an LPFK_CTX struct initialised by lpfk_open_ex()
+ * 					with LPFK_OPT_IO_THREAD.
+ * @param	name	Segment name for shm_open(), e.g. "/lpfk". Other
+ * 					processes pass the same name to lpfk_shm_attach().
+ * @param	mode	Permissions for the segment, less the umask. Anyone who
+ * 					can write to it can drive the LEDs; 0600 keeps it to
+ * 					the owner's processes.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on a bad name or a context
+ * 			without an I/O thread, LPFK_E_BUSY if a segment with that name
+ * 			already exists, LPFK_E_COMMS if the segment or flusher thread
+ * 			could not be created.
+ * @note	The segment starts with the LPFK's cached LED mask. From then
+ * 			on the segment is the LED mask: the flusher copies it into the
+ * 			context's cached mask before every frame, so changes made with
+ * 			lpfk_set_led_cached() and friends are overwritten.
+ * @note	The flusher sends with lpfk_flush_leds() from its own thread,
+ * 			which is why the context needs the I/O thread. The application
+ * 			can go on reading keys from it as usual. Each frame's status is
+ * 			published once the LPFK has answered it, and changes made in
+ * 			the meantime go out together in the next frame.
+ */
+int lpfk_shm_create(LPFK_SHM *shm, LPFK_CTX *ctx, const char *name,
+		const mode_t mode);
+
+/**
+ * @brief	Map a shared-memory framebuffer created by another process.
+ * @param	shm		Pointer to an LPFK_SHM struct to initialise.
+ * @param	name	Segment name passed to lpfk_shm_create().
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on a bad name,
+ * 			LPFK_E_NOT_PRESENT if there is no such framebuffer.
+ */
+int lpfk_shm_attach(LPFK_SHM *shm, const char *name);
+
+/**
+ * @brief	Unmap a shared-memory framebuffer.
+ * @param	shm		Pointer to an LPFK_SHM initialised by lpfk_shm_create()
+ * 					or lpfk_shm_attach().
+ * @return	LPFK_E_OK
+ * @note	If this process created the framebuffer, the flusher is stopped
+ * 			and the segment removed. Processes still attached keep their
+ * 			mapping, but nothing reaches the LPFK any more.
+ */
+int lpfk_shm_close(LPFK_SHM *shm);
+
+/**
+ * @brief	Replace the whole LED mask.
+ * @param	shm		Pointer to an LPFK_SHM initialised by lpfk_shm_create()
+ * 					or lpfk_shm_attach().
+ * @param	mask	New LED mask; bit n set (LPFK_LED(n)) lights LED n.
+ * @return	LPFK_E_OK
+ */
+int lpfk_shm_set_mask(LPFK_SHM *shm, const unsigned long mask);
+
+/**
+ * @brief	Set, clear and toggle several LEDs at once.
+ * @param	shm		Pointer to an LPFK_SHM initialised by lpfk_shm_create()
+ * 					or lpfk_shm_attach().
+ * @param	set		Mask of LEDs to turn on.
+ * @param	clear	Mask of LEDs to turn off.
+ * @param	toggle	Mask of LEDs to invert.
+ * @return	LPFK_E_OK
+ * @note	As lpfk_modify_leds(), and atomic with respect to every other
+ * 			process changing the framebuffer.
+ */
+int lpfk_shm_modify(LPFK_SHM *shm, const unsigned long set,
+		const unsigned long clear, const unsigned long toggle);
+
+/**
+ * @brief	Get the LED mask.
+ * @param	shm		Pointer to an LPFK_SHM initialised by lpfk_shm_create()
+ * 					or lpfk_shm_attach().
+ * @return	LED mask; bit n set (LPFK_LED(n)) if LED n is to be lit.
+ */
+unsigned long lpfk_shm_get_mask(LPFK_SHM *shm);
+
+/**
+ * @brief	Find out what the flusher last sent to the LPFK.
+ * @param	shm		Pointer to an LPFK_SHM initialised by lpfk_shm_create()
+ * 					or lpfk_shm_attach().
+ * @param	status	Pointer to an LPFK_SHM_STATUS struct to receive the status.
+ * @return	LPFK_E_OK
+ */
+int lpfk_shm_get_status(LPFK_SHM *shm, LPFK_SHM_STATUS *status);
+
+#endif // _lpfk_shm_h_included
@@ -0,0 +1,292 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_sim.h
+ * @brief	liblpfk LPFK simulator
+ *
+ * The simulator creates a pseudo-terminal and behaves like an IBM 6094-020
+ * on it: it answers READ CONFIGURATION with 0x03, acknowledges LED frames
+ * with 0x81, keeps track of the LED state and the keyboard enable, and
+ * sends keypresses when told to. Optionally it models the 9600 baud 8O1
+ * line, so every byte takes as long to arrive as it would on a real LPFK.
+ * Pass the path from lpfk_sim_path() to lpfk_open() to talk to it, or the
+ * transport from lpfk_sim_transport() to lpfk_open_transport().
+ *
+ * The simulator can also sit on a socketpair, or skip descriptors altogether
+ * and run inside the host's calls to the transport (loopback), which takes
+ * the kernel out of the picture when benchmarking the protocol engine.
+ */
+
+#ifndef _lpfk_sim_h_included
+#define _lpfk_sim_h_included
+
+#include <pthread.h>
+#include "liblpfk.h"
+
+/// Number of keypresses which can be waiting to be sent by the simulator
+#define LPFK_SIM_MAX_KEYS	256
+
+/// Time taken to send one byte at 9600 baud, 8O1 (11 bits), in nanoseconds
+#define LPFK_SIM_CHAR_NS	(11 * 1000000000LL / 9600)
+
+typedef struct lpfk_sim LPFK_SIM;
+
+/**
+ * @brief	LED update callback
+ * @param	sim		Simulator which received the LED frame.
+ * @param	mask	New LED mask; bit n set (LPFK_LED(n)) if LED n is lit.
+ * @param	user	User data pointer passed to lpfk_sim_set_led_cb().
+ * @note	Called from whichever thread is running the simulator, as soon
+ * 			as the simulated LPFK has received the whole frame.
+ */
+typedef void (*LPFK_SIM_LED_CB)(LPFK_SIM *sim, const unsigned long mask,
+		void *user);
+
+/**
+ * @brief	Simulator flags, for LPFK_SIM_OPTIONS.flags
+ */
+enum {
+	/// Model the 9600 baud 8O1 line, so each byte takes LPFK_SIM_CHAR_NS
+	LPFK_SIM_LINE_TIMING = 0x0001,
+	/// Talk to the host over a socketpair instead of a pty
+	LPFK_SIM_SOCKETPAIR = 0x0002,
+	/// No descriptors: the host's transport calls run the simulator
+	LPFK_SIM_LOOPBACK = 0x0004
+};
+
+/**
+ * @brief	Simulator options, passed to lpfk_sim_open().
+ */
+typedef struct {
+	int		flags;			///< LPFK_SIM_* flags
+	int		latency_us;		///< Time the LPFK takes to act on a command
+	int		nak_every;		///< Ask for every nth LED frame to be resent (0 = never)
+	int		ack_drop_every;	///< Ignore every nth LED frame completely (0 = never)
+} LPFK_SIM_OPTIONS;
+
+/// Scheduled keypress
+typedef struct {
+	int			key;		///< keycode
+	long long	due;		///< time to send it (ns)
+} LPFK_SIM_KEY;
+
+/// Byte on its way across the simulated serial line
+typedef struct {
+	unsigned char	byte;	///< data
+	long long		due;	///< time it finishes arriving (ns)
+} LPFK_SIM_BYTE;
+
+/// Number of bytes which can be in flight in each direction
+#define LPFK_SIM_LINE_SLOTS	256
+
+/**
+ * @brief	LPFK simulator
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+struct lpfk_sim {
+	int					master_fd;	///< pty master or socket, -1 for loopback
+	int					slave_fd;	///< pty slave or host's socket, held open
+	int					wake_efd;	///< eventfd: API call needs attention
+	char				path[LPFK_PATH_MAX];	///< pty slave path
+	LPFK_SIM_OPTIONS	opts;		///< options
+	pthread_mutex_t		lock;		///< protects everything below
+	pthread_t			thread;		///< background thread
+	int					running;	///< background thread running
+
+	int					enabled;	///< keyboard enabled
+	unsigned long		led_mask;	///< LED state (bit n = LED n)
+	unsigned char		frame[5];	///< LED frame being received
+	int					frame_len;	///< bytes of frame received so far
+	unsigned long		frames;		///< number of LED frames received
+	unsigned long		probes;		///< number of probes received
+
+	LPFK_SIM_BYTE		rxq[LPFK_SIM_LINE_SLOTS];	///< host -> LPFK bytes
+	unsigned int		rxq_head, rxq_tail;
+	long long			rx_free;	///< time host -> LPFK line is next idle
+	LPFK_SIM_BYTE		txq[LPFK_SIM_LINE_SLOTS];	///< LPFK -> host bytes
+	unsigned int		txq_head, txq_tail;
+	long long			tx_free;	///< time LPFK -> host line is next idle
+
+	LPFK_SIM_KEY		keys[LPFK_SIM_MAX_KEYS];	///< scheduled keypresses
+	int					nkeys;		///< number of scheduled keypresses
+	long long			script_time;	///< time of the last scripted press
+
+	LPFK_SIM_LED_CB		led_cb;		///< LED update callback
+	void				*led_user;	///< LED update callback user data
+};
+
+/**
+ * @brief	Fill in an LPFK_SIM_OPTIONS struct with the default options.
+ * @param	opts	Pointer to the LPFK_SIM_OPTIONS struct to initialise.
+ */
+void lpfk_sim_default_options(LPFK_SIM_OPTIONS *opts);
+
+/**
+ * @brief	Create a simulated LPFK on a new pseudo-terminal, socketpair or
+ * 			loopback.
+ * @param	sim		Pointer to an LPFK_SIM struct to initialise.
+ * @param	opts	Simulator options, or NULL for the defaults.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad options,
+ * 			LPFK_E_PORT_OPEN if the pseudo-terminal or socketpair could not
+ * 			be created.
+ */
+int lpfk_sim_open(LPFK_SIM *sim, const LPFK_SIM_OPTIONS *opts);
+
+/**
+ * @brief	Destroy a simulated LPFK, stopping its thread if it has one.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	LPFK_E_OK
+ */
+int lpfk_sim_close(LPFK_SIM *sim);
+
+/**
+ * @brief	Get the path of the simulated LPFK's serial port.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	Path to pass to lpfk_open(); empty unless the simulator is on
+ * 			a pseudo-terminal.
+ */
+const char *lpfk_sim_path(LPFK_SIM *sim);
+
+/**
+ * @brief	Set up a transport to the simulated LPFK.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @param	t		Pointer to an LPFK_TRANSPORT struct to initialise, for
+ * 					lpfk_open_transport().
+ * @return	LPFK_E_OK on success, LPFK_E_PORT_OPEN if the simulator's port
+ * 			could not be opened.
+ * @note	A loopback transport has no descriptor: the simulator does its
+ * 			work when the host reads, writes or asks for a timeout, so the
+ * 			host must follow lpfk_get_timeout().
+ */
+int lpfk_sim_transport(LPFK_SIM *sim, LPFK_TRANSPORT *t);
+
+/**
+ * @brief	Run the simulator on a background thread.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	LPFK_E_OK on success, LPFK_E_COMMS if the thread could not be
+ * 			started.
+ * @note	Does nothing for a loopback simulator, which has no thread.
+ */
+int lpfk_sim_start(LPFK_SIM *sim);
+
+/**
+ * @brief	Stop the simulator's background thread.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	LPFK_E_OK
+ */
+int lpfk_sim_stop(LPFK_SIM *sim);
+
+/**
+ * @brief	Do any simulator work which is due, without blocking.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	LPFK_E_OK
+ * @note	For running the simulator from an application's own event loop
+ * 			instead of lpfk_sim_start(). Call it when the descriptor from
+ * 			lpfk_sim_get_fd() is readable, or lpfk_sim_get_timeout() has
+ * 			passed.
+ */
+int lpfk_sim_process(LPFK_SIM *sim);
+
+/**
+ * @brief	Get the simulator's end of the pseudo-terminal or socketpair.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	File descriptor which becomes readable when the host sends
+ * 			something; -1 for a loopback simulator.
+ */
+int lpfk_sim_get_fd(LPFK_SIM *sim);
+
+/**
+ * @brief	Get the time until the simulator next has work to do.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	Milliseconds until lpfk_sim_process() must next be called,
+ * 			rounded up, or -1 if nothing is scheduled.
+ */
+int lpfk_sim_get_timeout(LPFK_SIM *sim);
+
+/**
+ * @brief	Press a key on the simulated LPFK.
+ * @param	sim			Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @param	key			Key number, 0 to 31.
+ * @param	delay_ms	Time from now to press the key.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter, LPFK_E_BUSY
+ * 			if too many keypresses are already waiting.
+ * @note	Like a real LPFK, the keypress is only sent if the keyboard has
+ * 			been enabled by the time it is due.
+ */
+int lpfk_sim_press(LPFK_SIM *sim, const int key, const int delay_ms);
+
+/**
+ * @brief	Schedule a sequence of keypresses.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @param	script	Keypresses separated by spaces or commas. Each is a key
+ * 					number, optionally followed by \@ and the time in
+ * 					milliseconds after the previous scripted keypress to
+ * 					press it (e.g. "0@500 1@100 2@100").
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if the script is invalid,
+ * 			LPFK_E_BUSY if too many keypresses are already waiting.
+ */
+int lpfk_sim_script(LPFK_SIM *sim, const char *script);
+
+/**
+ * @brief	Get the simulated LPFK's LED state.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	LED mask; bit n set (LPFK_LED(n)) if LED n is lit.
+ */
+unsigned long lpfk_sim_get_leds(LPFK_SIM *sim);
+
+/**
+ * @brief	Find out whether the simulated LPFK's keyboard is enabled.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @return	true if enabled, false if not.
+ */
+int lpfk_sim_get_enabled(LPFK_SIM *sim);
+
+/**
+ * @brief	Set the LED update callback.
+ * @param	sim		Pointer to an LPFK_SIM initialised by lpfk_sim_open().
+ * @param	cb		Callback function, or NULL.
+ * @param	user	User data pointer passed to the callback.
+ */
+void lpfk_sim_set_led_cb(LPFK_SIM *sim, LPFK_SIM_LED_CB cb, void *user);
+
+#endif // _lpfk_sim_h_included
@@ -0,0 +1,179 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_trace.h
+ * @brief	liblpfk serial traffic trace
+ *
+ * When LPFK_OPTIONS.trace_path is set, lpfk_open_ex() records every byte
+ * sent to and received from the LPFK in a trace file, from the first probe
+ * onwards. The file is a header followed by a ring of fixed size records,
+ * mapped into memory, so recording a burst costs a timestamp and a copy --
+ * no system calls. Once the ring is full, the oldest records are
+ * overwritten.
+ *
+ * lpfkreplay plays a trace back to the host on a pseudo-terminal, standing
+ * in for the LPFK.
+ */
+
+#ifndef _lpfk_trace_h_included
+#define _lpfk_trace_h_included
+
+#include <stdint.h>
+#include "liblpfk.h"
+
+/// LPFK_TRACE_HDR.magic value
+#define LPFK_TRACE_MAGIC	"LPFKTRC1"
+
+/// Number of records in a trace file if LPFK_OPTIONS.trace_records is 0
+#define LPFK_TRACE_DEFAULT_RECORDS	65536
+
+/// Number of data bytes in a trace record. Longer bursts take several.
+#define LPFK_TRACE_DATA		20
+
+/**
+ * @brief	Trace record directions, for LPFK_TRACE_REC.dir
+ */
+enum {
+	LPFK_TRACE_TX = 0,			///< Sent by the host to the LPFK
+	LPFK_TRACE_RX				///< Sent by the LPFK to the host
+};
+
+/**
+ * @brief	Trace file header
+ */
+typedef struct {
+	char		magic[8];	///< LPFK_TRACE_MAGIC, without the NUL
+	uint32_t	rec_size;	///< sizeof(LPFK_TRACE_REC)
+	uint32_t	nrecords;	///< number of records in the ring
+	uint64_t	count;		///< records ever written; the newest is at
+							///< (count - 1) % nrecords
+	uint64_t	start_ns;	///< CLOCK_MONOTONIC time the trace was started
+	uint8_t		reserved[32];	///< set to zero
+} LPFK_TRACE_HDR;
+
+/**
+ * @brief	Trace record
+ */
+typedef struct {
+	uint64_t	ts_ns;		///< CLOCK_MONOTONIC time of the read or write
+	uint8_t		dir;		///< LPFK_TRACE_TX or LPFK_TRACE_RX
+	uint8_t		len;		///< number of bytes of data used
+	uint16_t	reserved;	///< set to zero
+	uint8_t		data[LPFK_TRACE_DATA];	///< bytes sent or received
+} LPFK_TRACE_REC;
+
+/**
+ * @brief	Trace file, being written or read
+ *
+ * Do not change any variables inside this struct, they are for liblpfk's
+ * internal use only.
+ */
+typedef struct lpfk_trace {
+	LPFK_TRACE_HDR	*hdr;		///< mapped file
+	LPFK_TRACE_REC	*rec;		///< the ring, just after the header
+	size_t			size;		///< size of the mapping
+} LPFK_TRACE;
+
+/**
+ * @brief	Create a trace file, replacing any existing file.
+ * @param	trace		Pointer to an LPFK_TRACE struct to initialise.
+ * @param	path		Path of the trace file.
+ * @param	nrecords	Number of records in the ring; 0 for
+ * 						LPFK_TRACE_DEFAULT_RECORDS.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM on bad parameter,
+ * 			LPFK_E_PORT_OPEN if the file could not be created.
+ * @note	lpfk_open_ex() does this for itself; this is for tools which
+ * 			want to write traces of their own.
+ */
+int lpfk_trace_create(LPFK_TRACE *trace, const char *path, const int nrecords);
+
+/**
+ * @brief	Open a trace file for reading.
+ * @param	trace	Pointer to an LPFK_TRACE struct to initialise.
+ * @param	path	Path of the trace file.
+ * @return	LPFK_E_OK on success, LPFK_E_PORT_OPEN if the file could not be
+ * 			opened, LPFK_E_PARAM if it isn't a trace file.
+ */
+int lpfk_trace_load(LPFK_TRACE *trace, const char *path);
+
+/**
+ * @brief	Close a trace file.
+ * @param	trace	Pointer to an LPFK_TRACE initialised by lpfk_trace_create()
+ * 					or lpfk_trace_load().
+ * @return	LPFK_E_OK
+ */
+int lpfk_trace_close(LPFK_TRACE *trace);
+
+/**
+ * @brief	Record a burst of bytes.
+ * @param	trace	Pointer to an LPFK_TRACE initialised by lpfk_trace_create().
+ * @param	dir		LPFK_TRACE_TX or LPFK_TRACE_RX.
+ * @param	ts_ns	CLOCK_MONOTONIC time the bytes were sent or received.
+ * @param	buf		Bytes sent or received.
+ * @param	len		Number of bytes.
+ * @note	Safe to call from several threads at once.
+ */
+void lpfk_trace_record(LPFK_TRACE *trace, const int dir, const long long ts_ns,
+		const void *buf, const size_t len);
+
+/**
+ * @brief	Get the number of records in a trace.
+ * @param	trace	Pointer to an LPFK_TRACE initialised by lpfk_trace_load().
+ * @return	Number of records which can be read with lpfk_trace_get().
+ */
+unsigned long lpfk_trace_count(LPFK_TRACE *trace);
+
+/**
+ * @brief	Get the number of records lost when the ring wrapped.
+ * @param	trace	Pointer to an LPFK_TRACE initialised by lpfk_trace_load().
+ * @return	Number of records overwritten by newer ones.
+ */
+unsigned long long lpfk_trace_lost(LPFK_TRACE *trace);
+
+/**
+ * @brief	Get a record from a trace.
+ * @param	trace	Pointer to an LPFK_TRACE initialised by lpfk_trace_load().
+ * @param	n		Record number, 0 for the oldest.
+ * @return	Pointer to the record, or NULL if n is out of range.
+ */
+const LPFK_TRACE_REC *lpfk_trace_get(LPFK_TRACE *trace, const unsigned long n);
+
+#endif // _lpfk_trace_h_included
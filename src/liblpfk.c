@@ -48,324 +48,2100 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
-#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
 #include <time.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <glob.h>
 
 #include "liblpfk.h"
+#include "lpfk_probes.h"
+#include "lpfk_trace.h"
 
-/* lpfk_open {{{ */
-int lpfk_open(LPFK_CTX *ctx, const char *port)
-{
-	struct termios newtio;
-	int status;
-	int fd;
-	int i;
+/// LED update state machine states
+enum {
+	LPFK_UPD_IDLE,				///< No update in progress
+	LPFK_UPD_WAIT_ACK,			///< Frame sent, waiting for 0x81 or 0x80
+	LPFK_UPD_BACKOFF			///< Waiting to retransmit the frame
+};
 
-	// open the serial port
-	fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);
-	if (fd < 0) return LPFK_E_PORT_OPEN;
+/// Number of keys the I/O thread can queue (must be a power of two)
+#define LPFK_IO_KEY_SLOTS	256
+/// Number of commands the I/O thread can queue (must be a power of two)
+#define LPFK_IO_CMD_SLOTS	64
 
-	// save current port settings
-	tcgetattr(fd, &ctx->oldtio);
+/// Single-producer, single-consumer lock-free ring buffer
+struct lpfk_ring {
+	unsigned int	head;		///< next slot to fill (producer)
+	char			pad1[60];	///< keep head and tail in separate cache lines
+	unsigned int	tail;		///< next slot to empty (consumer)
+	char			pad2[60];
+	unsigned int	slots;		///< number of slots, a power of two
+	size_t			size;		///< size of one slot
+	unsigned char	*buf;		///< slot storage
+};
 
-	// set up new parameters
-	memset(&newtio, 0, sizeof(newtio));
-	// 9600 baud, 8 bits, parity enabled, odd parity
-	newtio.c_cflag = B9600 | CS8 | PARENB | PARODD | CLOCAL | CREAD;
-	newtio.c_iflag = 0;
-	newtio.c_oflag = 0;
+/// Command queued for the I/O thread
+typedef struct {
+	int				op;			///< LPFK command byte, or 0 to stop the thread
+	unsigned long	mask;		///< LED mask, for 0x94
+	unsigned int	seq;		///< LED update sequence number, for 0x94
+} LPFK_IO_CMD;
 
-	// set input mode -- non canonical, no echo
-	newtio.c_lflag = 0;
+/// I/O thread state
+struct lpfk_iothread {
+	pthread_t		thread;			///< I/O thread
+	int				cmd_efd;		///< eventfd: commands queued
+	int				key_efd;		///< eventfd: keys queued
+	int				key_signalled;	///< key_efd has been written to
+	struct lpfk_ring	cmds;		///< application -> thread commands
+	struct lpfk_ring	keys;		///< thread -> application key events
 
-	// inter-character timer unused
-	newtio.c_cc[VTIME] = 0;
-	// read does not block waiting for characters if there are none in the buffer
-	newtio.c_cc[VMIN]  = 0;
+	// written by the application thread
+	unsigned int	led_submitted;	///< sequence number of last LED update queued
 
-	// flush input buffer
-	tcflush(fd, TCIFLUSH);
+	// written by the I/O thread
+	unsigned int	led_done;		///< sequence number of last LED update finished
+	int				led_result;		///< result of last LED update finished
+	bool			led_pending;	///< LED update waiting for the LPFK to be free
+	unsigned long	pending_mask;	///< LED mask waiting to be sent
+	unsigned int	pending_seq;	///< sequence number of pending_mask
+	unsigned int	sending_seq;	///< sequence number of the frame in flight
+	unsigned int	flush_seen;		///< last lpfk_flush_leds() request handled
+	bool			flush_sending;	///< the frame in flight answers flush_seen
+	unsigned int	flush_done;		///< last lpfk_flush_leds() request finished
+	int				flush_result;	///< result of sending it
+};
 
-	// set new port config
-	tcsetattr(fd, TCSANOW, &newtio);
+static int lpfk_io_start(LPFK_CTX *ctx);
+static void lpfk_io_stop(LPFK_CTX *ctx);
+static int lpfk_io_submit(LPFK_CTX *ctx, const int op, const unsigned long mask);
+static int lpfk_io_read(LPFK_CTX *ctx, LPFK_KEY_EVENT *events, const int max);
+static int lpfk_io_update_status(LPFK_CTX *ctx);
+static void lpfk_efd_signal(const int efd);
+static void lpfk_io_led_next(LPFK_CTX *ctx);
 
-	// set RTS true to pull the LPFK out of reset
-	ioctl(fd, TIOCMGET, &status);
-	status |= TIOCM_RTS;
-	ioctl(fd, TIOCMSET, &status);
+/* lpfk_time_ms {{{ */
+/**
+ * Get the current time in milliseconds from the monotonic clock. Only useful
+ * for measuring intervals -- it is not related to the time of day.
+ */
+static long long lpfk_time_ms(void)
+{
+	struct timespec ts;
 
-	// wait a few seconds for the LPFK to become ready
-	sleep(2);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
 
-	// 0x06: READ CONFIGURATION. LPFK sends 0x03 in response.
-	// Try five times to wake it up.
-	status = false;
-	for (i=0; i<5; i++) {
-		unsigned char buf;
-		time_t tm;
+/**
+ * Convert a CLOCK_MONOTONIC timestamp to nanoseconds.
+ */
+static long long lpfk_ts_ns(const struct timespec *ts)
+{
+	return ((long long)ts->tv_sec * 1000000000LL) + ts->tv_nsec;
+}
 
-		// Send 0x06: READ CONFIGURATION, loop on failure
-		if (write(fd, "\x06", 1) < 1) {
-			continue;
-		}
+/**
+ * Get the current time in nanoseconds from the monotonic clock.
+ */
+static long long lpfk_time_ns(void)
+{
+	struct timespec ts;
 
-		// save current time (in seconds)
-		tm = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return lpfk_ts_ns(&ts);
+}
+/* }}} */
 
-		// loop until 2 seconds have passed, or LPFK responds
-		status = false;
-		do {
-			// read data, loop if not successful
-			if (read(fd, &buf, 1) < 1) {
-				continue;
-			}
+/* Statistics {{{ */
+/**
+ * Add to a statistics counter. Counters may be read by another thread while
+ * the I/O thread updates them, but only one thread ever writes each one, so
+ * a relaxed load and store keep readers from seeing a torn value without
+ * the locked read-modify-write an atomic add would cost.
+ */
+static inline void lpfk_stat_add(unsigned long long *counter, const unsigned long long n)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+			__ATOMIC_RELAXED);
+}
 
-			// we got some data, what is it?
-			if (buf == 0x03) {
-				// 0x03 -- correct response. we're done.
-				status = true;
-			}
-		} while (((time(NULL) - tm) < 2) && (!status));
+/**
+ * Count a sample in a histogram.
+ *
+ * @param	hist	Histogram, LPFK_STATS_BUCKETS long.
+ * @param	ns		Sample, in nanoseconds.
+ */
+static void lpfk_stat_hist(unsigned long long *hist, const long long ns)
+{
+	long long us = ns / 1000;
+	int b = 0;
 
-		// exit loop if we got the LPFK to talk
-		if (status) {
-			break;
-		}
+	while ((b < (LPFK_STATS_BUCKETS - 1)) && (us >= LPFK_STATS_BUCKET_US(b))) {
+		b++;
 	}
 
-	// Did the LPFK respond?
-	if (!status) {
-		// LPFK isn't talking. Restore serial port state and exit.
-		tcsetattr(fd, TCSANOW, &ctx->oldtio);
-		close(fd);
-		
-		return LPFK_E_NOT_PRESENT;
-	} else {
-		// Initialise LPFK context
-		ctx->led_mask = 0;
-		ctx->fd = fd;
+	lpfk_stat_add(&hist[b], 1);
+}
 
-		// Disable LPFK keyboard scanning
-		lpfk_enable(ctx, false);
+/**
+ * Write to the LPFK, keeping count of the bytes sent and tracing them.
+ */
+static ssize_t lpfk_write(LPFK_CTX *ctx, const void *buf, const size_t len)
+{
+	ssize_t n = ctx->transport.ops->write(&ctx->transport, buf, len);
 
-		// Return OK status
-		return LPFK_E_OK;
+	LPFK_PROBE3(cmd_write, *(const unsigned char *)buf, len, n);
+
+	if (n > 0) {
+		lpfk_stat_add(&ctx->stats.bytes_tx, n);
+		if (ctx->trace != NULL) {
+			lpfk_trace_record(ctx->trace, LPFK_TRACE_TX, lpfk_time_ns(), buf, n);
+		}
 	}
+	return n;
 }
-
 /* }}} */
 
-/* lpfk_close {{{ */
-int lpfk_close(LPFK_CTX *ctx)
+/* Ring buffers {{{ */
+/**
+ * Allocate storage for a ring buffer.
+ */
+static bool lpfk_ring_init(struct lpfk_ring *r, const unsigned int slots,
+		const size_t size)
 {
-	int status;
+	r->head = 0;
+	r->tail = 0;
+	r->slots = slots;
+	r->size = size;
+	r->buf = calloc(slots, size);
+	return (r->buf != NULL);
+}
+
+/**
+ * Add an item to a ring buffer. Must only be called by the producer.
+ *
+ * @return	true on success, false if the ring is full.
+ */
+static bool lpfk_ring_push(struct lpfk_ring *r, const void *item)
+{
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
 
-	// 0x09: DISABLE. Stop the LPFK responding to keystrokes.
-	write(ctx->fd, "\x09", 1);
+	if ((head - tail) >= r->slots) {
+		return false;
+	}
 
-	// turn all the LEDs off
-	lpfk_set_leds(ctx, false);
+	memcpy(r->buf + ((head & (r->slots - 1)) * r->size), item, r->size);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
 
-	// set RTS false to put the LPFK into reset
-	ioctl(ctx->fd, TIOCMGET, &status);
-	status &= ~TIOCM_RTS;
-	ioctl(ctx->fd, TIOCMSET, &status);
+/**
+ * Take an item from a ring buffer. Must only be called by the consumer.
+ *
+ * @return	true on success, false if the ring is empty.
+ */
+static bool lpfk_ring_pop(struct lpfk_ring *r, void *item)
+{
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
 
-	// Restore the port state and close the serial port.
-	tcsetattr(ctx->fd, TCSANOW, &ctx->oldtio);
-	close(ctx->fd);
+	if (head == tail) {
+		return false;
+	}
 
-	// Done!
-	return LPFK_E_OK;
+	memcpy(item, r->buf + ((tail & (r->slots - 1)) * r->size), r->size);
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
 }
 /* }}} */
 
-/* lpfk_enable {{{ */
-int lpfk_enable(LPFK_CTX *ctx, const int val)
+/* lpfk_sleep_ms {{{ */
+/**
+ * Sleep for a number of milliseconds on the monotonic clock.
+ */
+static void lpfk_sleep_ms(const int ms)
 {
-	if (val) {
-		// val == true, enable the LPFK
-		if (write(ctx->fd, "\x08", 1) != 1) {
-			ctx->enabled = true;
-			return LPFK_E_COMMS;
-		}
-	} else {
-		// val == false, disable the LPFK
-		if (write(ctx->fd, "\x09", 1) != 1) {
-			return LPFK_E_COMMS;
-		}
+	struct timespec ts;
+
+	if (ms <= 0) {
+		return;
 	}
 
-	// update the context, return success
-	ctx->enabled = val;
-	return LPFK_E_OK;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+		;
 }
-
 /* }}} */
 
-/* lpfk_set_led_cached {{{ */
-int lpfk_set_led_cached(LPFK_CTX *ctx, const int num, const int state)
+/* lpfk_backoff_ms {{{ */
+/**
+ * Work out how long to wait before retrying a command.
+ *
+ * @param	timing		Timing policy.
+ * @param	attempts	Number of attempts made so far (1 or more).
+ */
+static int lpfk_backoff_ms(const LPFK_TIMING *timing, const int attempts)
 {
+	int delay = timing->backoff_ms;
 	int i;
-	time_t tm;
-	unsigned long mask, leds;
-	unsigned char buf[5];
-	unsigned char status;
 
-	// check parameters
-	if ((num < 0) || (num > 31)) {
-		return LPFK_E_PARAM;
+	for (i=1; i<attempts; i++) {
+		if ((timing->backoff_max_ms > 0) && (delay >= timing->backoff_max_ms)) {
+			break;
+		}
+		delay *= 2;
 	}
 
-	// parameters OK, now build the LED mask
-	mask = (0x80 >> (num % 8)) << ((3 - (num / 8)) * 8);
-
-	// mask the specified bit
-	if (state) {
-		ctx->led_mask |= mask;
-	} else {
-		ctx->led_mask &= ~mask;
+	if ((timing->backoff_max_ms > 0) && (delay > timing->backoff_max_ms)) {
+		delay = timing->backoff_max_ms;
 	}
 
-	return LPFK_E_OK;
+	return delay;
 }
 /* }}} */
 
-/* lpfk_set_leds_cached {{{ */
-int lpfk_set_leds_cached(LPFK_CTX *ctx, const int state)
+/* lpfk_timing_valid {{{ */
+/**
+ * Sanity-check a timing policy.
+ */
+static bool lpfk_timing_valid(const LPFK_TIMING *timing)
+{
+	return (timing->open_timeout_ms >= 0) && (timing->reset_delay_ms >= 0) &&
+		(timing->probe_timeout_ms > 0) && (timing->probe_attempts >= 0) &&
+		((timing->open_timeout_ms > 0) || (timing->probe_attempts > 0)) &&
+		(timing->ack_timeout_ms >= 0) && (timing->ack_attempts >= 1) &&
+		(timing->backoff_ms >= 0) && (timing->backoff_max_ms >= 0) &&
+		(timing->backoff_ms <= (1 << 24));
+}
+/* }}} */
+
+/* lpfk_probe {{{ */
+/**
+ * Send READ CONFIGURATION (0x06) probes to a serial port until the LPFK
+ * responds with 0x03, we run out of attempts or the open deadline passes.
+ *
+ * @param	t			Transport to the LPFK.
+ * @param	timing		Timing policy.
+ * @param	open_deadline	Time at which to give up (ms), 0 for no limit.
+ * @param	stats		Counters to update.
+ * @param	trace		Trace to record the traffic in, or NULL.
+ * @return	true if the LPFK responded, false if not.
+ */
+static bool lpfk_probe(LPFK_TRANSPORT *t, const LPFK_TIMING *timing,
+		const long long open_deadline, LPFK_STATS *stats, LPFK_TRACE *trace)
 {
+	struct pollfd pfd;
+	unsigned char buf;
+	long long deadline;
+	int remaining, rx;
 	int i;
-	time_t tm;
-	unsigned long leds;
-	unsigned char buf[5];
-	unsigned char status;
 
-	if (state) {
-		// all LEDs on
-		ctx->led_mask = 0xFFFFFFFF;
-	} else {
-		// all LEDs off
-		ctx->led_mask = 0x00000000;
+	pfd.fd = t->fd;
+	pfd.events = POLLIN;
+
+	for (i=0; (timing->probe_attempts == 0) || (i < timing->probe_attempts); i++) {
+		// back off before retrying
+		if (i > 0) {
+			lpfk_sleep_ms(lpfk_backoff_ms(timing, i));
+		}
+
+		// give up if we've run out of time
+		if ((open_deadline > 0) && (lpfk_time_ms() >= open_deadline)) {
+			break;
+		}
+
+		// Send 0x06: READ CONFIGURATION, loop on failure
+		if (t->ops->write(t, "\x06", 1) < 1) {
+			continue;
+		}
+		lpfk_stat_add(&stats->probes, 1);
+		lpfk_stat_add(&stats->bytes_tx, 1);
+		if (trace != NULL) {
+			lpfk_trace_record(trace, LPFK_TRACE_TX, lpfk_time_ns(), "\x06", 1);
+		}
+		LPFK_PROBE1(probe_send, i + 1);
+
+		// loop until the probe times out, or LPFK responds
+		deadline = lpfk_time_ms() + timing->probe_timeout_ms;
+		if ((open_deadline > 0) && (deadline > open_deadline)) {
+			deadline = open_deadline;
+		}
+		while (true) {
+			// we got some data, what is it?
+			while (t->ops->read(t, &buf, 1) == 1) {
+				lpfk_stat_add(&stats->bytes_rx, 1);
+				if (trace != NULL) {
+					lpfk_trace_record(trace, LPFK_TRACE_RX, lpfk_time_ns(), &buf, 1);
+				}
+				if (buf == 0x03) {
+					// 0x03 -- correct response. we're done.
+					return true;
+				}
+			}
+
+			remaining = deadline - lpfk_time_ms();
+			if (remaining <= 0) {
+				break;
+			}
+			// a transport with no descriptor says when to look again
+			if (t->ops->rx_timeout != NULL) {
+				rx = t->ops->rx_timeout(t);
+				if ((rx >= 0) && (rx < remaining)) {
+					remaining = rx;
+				}
+			}
+			poll(&pfd, 1, remaining);
+		}
 	}
 
-	return LPFK_E_OK;
+	return false;
 }
 /* }}} */
 
-/* lpfk_update_leds {{{ */
-int lpfk_update_leds(LPFK_CTX *ctx)
+/* lpfk_discover_ports {{{ */
+/// Per-port probe state for lpfk_discover_ports()
+typedef struct {
+	LPFK_TRANSPORT	t;			///< serial port
+	bool			open;		///< port still being probed
+	int				attempts;	///< number of probes sent
+	long long		next_probe;	///< time to send the next probe (ms)
+} LPFK_DISCOVER_PORT;
+
+/**
+ * Finish with a probed port. Whatever is on the other end -- an LPFK, or a
+ * modem which didn't expect RTS to change -- gets its reset line back the
+ * way lpfk_close() leaves it.
+ */
+static void lpfk_discover_close(LPFK_DISCOVER_PORT *dp)
 {
-	int i;
-	time_t tm;
-	unsigned char buf[5];
-	unsigned char status;
-
-	// send new LED mask to the LPFK
-	buf[0] = 0x94;
-	buf[1] = ctx->led_mask >> 24;
-	buf[2] = ctx->led_mask >> 16;
-	buf[3] = ctx->led_mask >> 8;
-	buf[4] = ctx->led_mask & 0xff;
-
-	// make 5 attempts to set the LEDs
-	for (i=0; i<5; i++) {
-		if (write(ctx->fd, &buf, 5) < 5) {
-			continue;
+	dp->t.ops->set_reset(&dp->t, true);
+	dp->t.ops->close(&dp->t);
+	dp->open = false;
+}
+
+int lpfk_discover_ports(const char *const *ports, const int nports,
+		int *present, const LPFK_TIMING *timing)
+{
+	LPFK_TIMING deftiming;
+	LPFK_DISCOVER_PORT *dp;
+	struct pollfd *pfd;
+	long long deadline, now, wake;
+	unsigned char buf[16];
+	int active = 0;
+	int found = 0;
+	int i, n;
+
+	if (timing == NULL) {
+		lpfk_default_timing(&deftiming);
+		timing = &deftiming;
+	}
+
+	if ((nports < 0) || !lpfk_timing_valid(timing)) {
+		return LPFK_E_PARAM;
+	}
+
+	if (nports == 0) {
+		return 0;
+	}
+
+	dp = calloc(nports, sizeof(*dp));
+	pfd = calloc(nports, sizeof(*pfd));
+	if ((dp == NULL) || (pfd == NULL)) {
+		free(dp);
+		free(pfd);
+		return LPFK_E_PARAM;
+	}
+
+	// give up when an lpfk_open() on a single port would have done
+	now = lpfk_time_ms();
+	if (timing->open_timeout_ms > 0) {
+		deadline = now + timing->open_timeout_ms;
+	} else {
+		deadline = 0;
+	}
+
+	// open all the ports and take any LPFKs out of reset
+	for (i=0; i<nports; i++) {
+		present[i] = false;
+		dp[i].open = (lpfk_transport_tty(&dp[i].t, ports[i]) == LPFK_E_OK);
+		dp[i].attempts = 0;
+		dp[i].next_probe = now + timing->reset_delay_ms;
+		if (dp[i].open) {
+			dp[i].t.ops->set_reset(&dp[i].t, false);
+			active++;
 		}
+	}
 
-		// check for response -- 0x81 = OK, 0x80 = retransmit
-		// save current time (in seconds)
-		tm = time(NULL);
+	// probe them all at once until every port has answered or given up
+	while (active > 0) {
+		now = lpfk_time_ms();
+		if ((deadline > 0) && (now >= deadline)) {
+			break;
+		}
 
-		// loop until 2 seconds have passed, or LPFK responds
-		status = 0x00;
-		do {
-			// read data, loop if not successful
-			if (read(ctx->fd, &status, 1) < 1) {
+		// send any probes which are due, and work out when to wake up
+		wake = deadline;
+		for (i=0; i<nports; i++) {
+			if (!dp[i].open) {
 				continue;
 			}
 
-			// we got some data, what is it?
-			if (status == 0x81) {
-				// 0x81 -- received successfully
-				break;
+			if (now >= dp[i].next_probe) {
+				if ((timing->probe_attempts > 0) &&
+						(dp[i].attempts >= timing->probe_attempts)) {
+					// out of attempts -- no LPFK on this port
+					lpfk_discover_close(&dp[i]);
+					active--;
+					continue;
+				}
+
+				// Send 0x06: READ CONFIGURATION
+				dp[i].t.ops->write(&dp[i].t, "\x06", 1);
+				dp[i].attempts++;
+				dp[i].next_probe = now + timing->probe_timeout_ms +
+					lpfk_backoff_ms(timing, dp[i].attempts);
+			}
+
+			if ((wake == 0) || (dp[i].next_probe < wake)) {
+				wake = dp[i].next_probe;
 			}
-		} while ((time(NULL) - tm) < 2);
+		}
 
-		// status OK?
-		if (status == 0x81) {
-			// 0x81: OK
+		// sleep until one of the ports answers or a probe is due
+		n = 0;
+		for (i=0; i<nports; i++) {
+			if (dp[i].open) {
+				pfd[n].fd = dp[i].t.fd;
+				pfd[n].events = POLLIN;
+				pfd[n].revents = 0;
+				n++;
+			}
+		}
+		if (n == 0) {
 			break;
-		} else if (status == 0x80) {
-			// 0x80: Retransmit request
-			continue;
+		}
+		poll(pfd, n, (wake > now) ? (int)(wake - now) : 0);
+
+		// check the answers
+		n = 0;
+		for (i=0; i<nports; i++) {
+			int nbytes, j;
+
+			if (!dp[i].open) {
+				continue;
+			}
+			if (!(pfd[n++].revents & POLLIN)) {
+				continue;
+			}
+
+			while ((nbytes = dp[i].t.ops->read(&dp[i].t, buf, sizeof(buf))) > 0) {
+				for (j=0; j<nbytes; j++) {
+					if (buf[j] == 0x03) {
+						present[i] = true;
+					}
+				}
+			}
+
+			if (present[i]) {
+				// 0x03 -- LPFK found on this port
+				found++;
+				lpfk_discover_close(&dp[i]);
+				active--;
+			}
 		}
 	}
 
-	return LPFK_E_OK;
+	// close the ports which didn't answer in time
+	for (i=0; i<nports; i++) {
+		if (dp[i].open) {
+			lpfk_discover_close(&dp[i]);
+		}
+	}
+
+	free(dp);
+	free(pfd);
+	return found;
 }
 /* }}} */
 
-/* lpfk_set_led {{{ */
-int lpfk_set_led(LPFK_CTX *ctx, const int num, const int state)
+/* lpfk_discover {{{ */
+int lpfk_discover(const char *pattern, LPFK_PORT_INFO *found, const int max,
+		const LPFK_TIMING *timing)
 {
-	lpfk_set_led_cached(ctx, num, state);
-	return lpfk_update_leds(ctx);
+	glob_t gl;
+	int *present;
+	int i, n, status;
+
+	if ((found == NULL) || (max < 0)) {
+		return LPFK_E_PARAM;
+	}
+
+	if (pattern == NULL) {
+		pattern = LPFK_DEFAULT_PORTS;
+	}
+
+	// find the candidate ports
+	status = glob(pattern, GLOB_BRACE, NULL, &gl);
+	if (status == GLOB_NOMATCH) {
+		return 0;
+	} else if (status != 0) {
+		return LPFK_E_PARAM;
+	}
+
+	present = calloc(gl.gl_pathc, sizeof(*present));
+	if (present == NULL) {
+		globfree(&gl);
+		return LPFK_E_PARAM;
+	}
+
+	// probe them all
+	status = lpfk_discover_ports((const char *const *)gl.gl_pathv,
+			gl.gl_pathc, present, timing);
+
+	// copy out the names of the ports which answered
+	if (status > 0) {
+		n = 0;
+		for (i=0; (i<(int)gl.gl_pathc) && (n<max); i++) {
+			if (present[i]) {
+				strncpy(found[n].path, gl.gl_pathv[i], sizeof(found[n].path) - 1);
+				found[n].path[sizeof(found[n].path) - 1] = '\0';
+				n++;
+			}
+		}
+		status = n;
+	}
+
+	free(present);
+	globfree(&gl);
+	return status;
 }
 /* }}} */
 
-/* lpfk_set_leds {{{ */
-int lpfk_set_leds(LPFK_CTX *ctx, const int state)
+/* lpfk_default_timing {{{ */
+void lpfk_default_timing(LPFK_TIMING *timing)
 {
-	lpfk_set_leds_cached(ctx, state);
-	return lpfk_update_leds(ctx);
+	timing->open_timeout_ms = 5000;
+	timing->reset_delay_ms = 0;
+	timing->probe_timeout_ms = 50;
+	timing->probe_attempts = 0;
+	timing->ack_timeout_ms = 2000;
+	timing->ack_attempts = 5;
+	timing->backoff_ms = 0;
+	timing->backoff_max_ms = 0;
 }
 /* }}} */
 
-/* lpfk_get_led {{{ */
-int lpfk_get_led(LPFK_CTX *ctx, const int num)
+/* lpfk_default_options {{{ */
+void lpfk_default_options(LPFK_OPTIONS *opts)
 {
-	unsigned long mask;
-
-	// check parameters
-	if ((num < 0) || (num > 31)) {
-		return false;
-	}
-
-	// parameters OK, now build the LED mask
-	mask = (0x80 >> (num % 8)) << ((3 - (num / 8)) * 8);
-	if (ctx->led_mask & mask) {
-		return true;
-	} else {
-		return false;
-	}
+	memset(opts, 0, sizeof(*opts));
+	lpfk_default_timing(&opts->timing);
 }
 /* }}} */
 
-/* lpfk_read {{{ */
-int lpfk_read(LPFK_CTX *ctx)
+/* lpfk_trace_start {{{ */
+/**
+ * Start recording a trace, if the options ask for one.
+ *
+ * @param	trace	Pointer to receive the trace, or NULL if not recording.
+ * @return	LPFK_E_OK on success, LPFK_E_PARAM if the trace file could not
+ * 			be created.
+ */
+static int lpfk_trace_start(const LPFK_OPTIONS *opts, LPFK_TRACE **trace)
 {
-	int nbytes;
-	unsigned char key;
+	*trace = NULL;
+	if (opts->trace_path == NULL) {
+		return LPFK_E_OK;
+	}
 
-	// make sure the LPFK is enabled before trying to read a scancode
-	if (!ctx->enabled) {
-		return LPFK_E_NOT_ENABLED;
+	*trace = malloc(sizeof(LPFK_TRACE));
+	if ((*trace == NULL) ||
+			(lpfk_trace_create(*trace, opts->trace_path, opts->trace_records) != LPFK_E_OK)) {
+		free(*trace);
+		*trace = NULL;
+		return LPFK_E_PARAM;
 	}
 
-	// try and read a byte (keycode) from the LPFK
-	nbytes = read(ctx->fd, &key, 1);
+	return LPFK_E_OK;
+}
 
-	if ((nbytes < 1) || (key > 31)) {
-		// no keys buffered, or keycode invalid.
-		return LPFK_E_NO_KEYS;
-	} else {
-		// key buffered, pass it along.
-		return key;
+/**
+ * Stop recording a trace started by lpfk_trace_start().
+ */
+static void lpfk_trace_stop(LPFK_TRACE *trace)
+{
+	if (trace != NULL) {
+		lpfk_trace_close(trace);
+		free(trace);
 	}
 }
 /* }}} */
 
+/* lpfk_open {{{ */
+int lpfk_open(LPFK_CTX *ctx, const char *port)
+{
+	return lpfk_open_ex(ctx, port, NULL);
+}
+/* }}} */
+
+/* lpfk_open_common {{{ */
+/**
+ * Bring up an LPFK on a transport which has been set up, and take it over.
+ * The transport is closed if this fails.
+ */
+static int lpfk_open_common(LPFK_CTX *ctx, LPFK_TRANSPORT *t,
+		const LPFK_OPTIONS *opts, const char *port)
+{
+	LPFK_TRACE *trace;
+	long long deadline = 0;
+	int status;
+
+	// start the trace first, so it catches the probes
+	if (lpfk_trace_start(opts, &trace) != LPFK_E_OK) {
+		t->ops->close(t);
+		return LPFK_E_PARAM;
+	}
+
+	LPFK_PROBE1(open_start, port);
+
+	if (opts->timing.open_timeout_ms > 0) {
+		deadline = lpfk_time_ms() + opts->timing.open_timeout_ms;
+	}
+
+	// ask the port not to sit on what the LPFK sends, before the probes
+	// go out
+	if ((opts->flags & LPFK_OPT_LOW_LATENCY) && (t->ops->low_latency != NULL)) {
+		t->ops->low_latency(t);
+	}
+
+	// take the LPFK out of reset
+	if (t->ops->set_reset != NULL) {
+		t->ops->set_reset(t, false);
+	}
+
+	// wait for the LPFK to come out of reset, if the policy asks us to.
+	// Otherwise start probing straight away; the LPFK ignores probes until
+	// it is ready, so the first answer tells us it is up.
+	lpfk_sleep_ms(opts->timing.reset_delay_ms);
+
+	// 0x06: READ CONFIGURATION. LPFK sends 0x03 in response.
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	status = lpfk_probe(t, &opts->timing, deadline, &ctx->stats, trace);
+
+	// Did the LPFK respond?
+	if (!status) {
+		// LPFK isn't talking. Restore serial port state and exit.
+		t->ops->close(t);
+		lpfk_trace_stop(trace);
+		
+		LPFK_PROBE2(open_done, LPFK_E_NOT_PRESENT, ctx->stats.probes);
+		return LPFK_E_NOT_PRESENT;
+	} else {
+		// discard any answers to earlier probes, so they can't be mistaken
+		// for keycode 3 later on
+		t->ops->flush_input(t);
+
+		// Initialise LPFK context
+		ctx->enabled = false;
+		ctx->keyq_head = ctx->keyq_tail = 0;
+		ctx->led_mask = 0;
+		ctx->shown_valid = false;
+		ctx->transport = *t;
+		ctx->timing = opts->timing;
+		ctx->upd_state = LPFK_UPD_IDLE;
+		ctx->upd_result = LPFK_E_OK;
+		ctx->upd_cb = NULL;
+		ctx->upd_user = NULL;
+		ctx->flush_gen = 0;
+		ctx->owner = pthread_self();
+		ctx->enable_want = false;
+		ctx->enable_sent = -1;
+		memset(ctx->echo, 0, sizeof(ctx->echo));
+		ctx->echo_timed = 0;
+		ctx->echo_pending = false;
+		ctx->io = NULL;
+		ctx->trace = trace;
+
+		// Disable LPFK keyboard scanning
+		lpfk_enable(ctx, false);
+
+		// Hand the port over to the I/O thread if we've been asked to
+		if (opts->flags & LPFK_OPT_IO_THREAD) {
+			if (lpfk_io_start(ctx) != LPFK_E_OK) {
+				ctx->transport.ops->close(&ctx->transport);
+				lpfk_trace_stop(trace);
+				LPFK_PROBE2(open_done, LPFK_E_COMMS, ctx->stats.probes);
+				return LPFK_E_COMMS;
+			}
+		}
+
+		// Return OK status
+		LPFK_PROBE2(open_done, LPFK_E_OK, ctx->stats.probes);
+		return LPFK_E_OK;
+	}
+}
+/* }}} */
+
+/* lpfk_open_ex {{{ */
+int lpfk_open_ex(LPFK_CTX *ctx, const char *port, const LPFK_OPTIONS *opts)
+{
+	LPFK_OPTIONS defopts;
+	LPFK_TRANSPORT t;
+
+	// use the default options if none were given
+	if (opts == NULL) {
+		lpfk_default_options(&defopts);
+		opts = &defopts;
+	}
+
+	if (!lpfk_timing_valid(&opts->timing) ||
+			(opts->flags & ~(LPFK_OPT_IO_THREAD | LPFK_OPT_LOW_LATENCY))) {
+		return LPFK_E_PARAM;
+	}
+
+	// open the serial port
+	if (lpfk_transport_tty(&t, port) != LPFK_E_OK) {
+		return LPFK_E_PORT_OPEN;
+	}
+
+	return lpfk_open_common(ctx, &t, opts, port);
+}
+/* }}} */
+
+/* lpfk_open_transport {{{ */
+int lpfk_open_transport(LPFK_CTX *ctx, LPFK_TRANSPORT *t,
+		const LPFK_OPTIONS *opts)
+{
+	LPFK_OPTIONS defopts;
+
+	// use the default options if none were given
+	if (opts == NULL) {
+		lpfk_default_options(&defopts);
+		opts = &defopts;
+	}
+
+	if (!lpfk_timing_valid(&opts->timing) ||
+			(opts->flags & ~(LPFK_OPT_IO_THREAD | LPFK_OPT_LOW_LATENCY))) {
+		t->ops->close(t);
+		return LPFK_E_PARAM;
+	}
+
+	return lpfk_open_common(ctx, t, opts, NULL);
+}
+/* }}} */
+
+/* lpfk_set_timing {{{ */
+int lpfk_set_timing(LPFK_CTX *ctx, const LPFK_TIMING *timing)
+{
+	// the I/O thread reads the policy as it goes, with no lock to change
+	// it under
+	if ((ctx->io != NULL) || !lpfk_timing_valid(timing)) {
+		return LPFK_E_PARAM;
+	}
+
+	ctx->timing = *timing;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_timing {{{ */
+int lpfk_get_timing(LPFK_CTX *ctx, LPFK_TIMING *timing)
+{
+	*timing = ctx->timing;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_stats {{{ */
+int lpfk_get_stats(LPFK_CTX *ctx, LPFK_STATS *stats)
+{
+	const unsigned long long *src = (const unsigned long long *)&ctx->stats;
+	unsigned long long *dst = (unsigned long long *)stats;
+	size_t i;
+
+	// the struct is nothing but counters; copy them one at a time so none
+	// is torn while the I/O thread is updating it
+	for (i=0; i<(sizeof(*stats) / sizeof(*dst)); i++) {
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_low_latency {{{ */
+int lpfk_get_low_latency(LPFK_CTX *ctx)
+{
+	return ctx->transport.lowlat;
+}
+/* }}} */
+
+/* lpfk_close {{{ */
+int lpfk_close(LPFK_CTX *ctx)
+{
+	// take the port back from the I/O thread. lpfk_flush() waits for the
+	// answer to any frame the thread left in flight before sending ours.
+	if (ctx->io != NULL) {
+		lpfk_io_stop(ctx);
+	}
+
+	// 0x09: DISABLE. Stop the LPFK responding to keystrokes, and turn all
+	// the LEDs off; both go in the same write.
+	ctx->enable_want = false;
+	ctx->enable_sent = -1;
+	lpfk_set_leds_cached(ctx, false);
+	lpfk_flush(ctx);
+
+	return lpfk_abandon(ctx);
+}
+/* }}} */
+
+/* lpfk_abandon {{{ */
+int lpfk_abandon(LPFK_CTX *ctx)
+{
+	// take the port back from the I/O thread, if lpfk_close() hasn't,
+	// and forget any update it left in flight
+	if (ctx->io != NULL) {
+		lpfk_io_stop(ctx);
+	}
+	ctx->upd_state = LPFK_UPD_IDLE;
+
+	// put the LPFK back into reset
+	if (ctx->transport.ops->set_reset != NULL) {
+		ctx->transport.ops->set_reset(&ctx->transport, true);
+	}
+
+	// Restore the port state and close the port.
+	ctx->transport.ops->close(&ctx->transport);
+
+	lpfk_trace_stop(ctx->trace);
+	ctx->trace = NULL;
+
+	// Done!
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* Command queue {{{ */
+/**
+ * Send the queued enable/disable command, if the LPFK isn't already in the
+ * state it asks for. LED frames pick it up on their own; this is for when
+ * there's no frame to send.
+ */
+static int lpfk_cmd_flush(LPFK_CTX *ctx)
+{
+	unsigned char byte;
+
+	if (ctx->enable_want == ctx->enable_sent) {
+		return LPFK_E_OK;
+	}
+
+	byte = ctx->enable_want ? 0x08 : 0x09;
+	if (lpfk_write(ctx, &byte, 1) != 1) {
+		ctx->enable_sent = -1;
+		return LPFK_E_COMMS;
+	}
+
+	ctx->enable_sent = ctx->enable_want;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_enable_cached {{{ */
+int lpfk_enable_cached(LPFK_CTX *ctx, const int val)
+{
+	// the I/O thread merges queued commands already
+	if (ctx->io != NULL) {
+		return lpfk_enable(ctx, val);
+	}
+
+	ctx->enabled = val;
+	ctx->enable_want = val ? true : false;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_flush {{{ */
+int lpfk_flush(LPFK_CTX *ctx)
+{
+	int result;
+
+	if (ctx->io != NULL) {
+		return lpfk_update_leds(ctx);
+	}
+
+	// the enable goes out with the LED frame if there is one...
+	result = lpfk_update_leds(ctx);
+
+	// ...and on its own if there isn't
+	if (lpfk_cmd_flush(ctx) != LPFK_E_OK) {
+		return LPFK_E_COMMS;
+	}
+
+	return result;
+}
+/* }}} */
+
+/* lpfk_enable {{{ */
+int lpfk_enable(LPFK_CTX *ctx, const int val)
+{
+	// let the I/O thread send the command if there is one
+	if (ctx->io != NULL) {
+		if (lpfk_io_submit(ctx, val ? 0x08 : 0x09, 0) != LPFK_E_OK) {
+			return LPFK_E_COMMS;
+		}
+		ctx->enabled = val;
+		return LPFK_E_OK;
+	}
+
+	// send it now, even if we think the LPFK is already in that state
+	ctx->enabled = val;
+	ctx->enable_want = val ? true : false;
+	ctx->enable_sent = -1;
+	return lpfk_cmd_flush(ctx);
+}
+
+/* }}} */
+
+/* lpfk_set_led_cached {{{ */
+int lpfk_set_led_cached(LPFK_CTX *ctx, const int num, const int state)
+{
+	// check parameters
+	if ((num < 0) || (num > 31)) {
+		return LPFK_E_PARAM;
+	}
+
+	// mask the specified bit; atomically, so other threads can change
+	// other bits at the same time
+	if (state) {
+		__atomic_fetch_or(&ctx->led_mask, LPFK_LED(num), __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_and(&ctx->led_mask, ~LPFK_LED(num), __ATOMIC_RELAXED);
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_set_leds_cached {{{ */
+int lpfk_set_leds_cached(LPFK_CTX *ctx, const int state)
+{
+	if (state) {
+		// all LEDs on
+		__atomic_store_n(&ctx->led_mask, LPFK_LED_ALL, __ATOMIC_RELAXED);
+	} else {
+		// all LEDs off
+		__atomic_store_n(&ctx->led_mask, 0, __ATOMIC_RELAXED);
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_set_mask {{{ */
+int lpfk_set_mask(LPFK_CTX *ctx, const unsigned long mask)
+{
+	__atomic_store_n(&ctx->led_mask, mask & LPFK_LED_ALL, __ATOMIC_RELAXED);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_mask {{{ */
+unsigned long lpfk_get_mask(LPFK_CTX *ctx)
+{
+	return __atomic_load_n(&ctx->led_mask, __ATOMIC_RELAXED);
+}
+/* }}} */
+
+/* lpfk_modify_leds {{{ */
+int lpfk_modify_leds(LPFK_CTX *ctx, const unsigned long set,
+		const unsigned long clear, const unsigned long toggle)
+{
+	unsigned long old, new;
+
+	// all three changes land together, even if other threads are changing
+	// the mask too
+	old = __atomic_load_n(&ctx->led_mask, __ATOMIC_RELAXED);
+	do {
+		new = (((old | set) & ~clear) ^ toggle) & LPFK_LED_ALL;
+	} while (!__atomic_compare_exchange_n(&ctx->led_mask, &old, new, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_invalidate_leds {{{ */
+int lpfk_invalidate_leds(LPFK_CTX *ctx)
+{
+	// may be read by the I/O thread
+	__atomic_store_n(&ctx->shown_valid, false, __ATOMIC_RELAXED);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_mask_to_wire {{{ */
+/**
+ * Convert an LED mask from natural order (bit n = LED n) to the order the
+ * LPFK expects in a 0x94 frame (LED 0 in the MSB, LED 31 in the LSB).
+ */
+static unsigned long lpfk_mask_to_wire(unsigned long mask)
+{
+	// reverse the order of the 32 bits
+	mask = ((mask >> 1) & 0x55555555UL) | ((mask & 0x55555555UL) << 1);
+	mask = ((mask >> 2) & 0x33333333UL) | ((mask & 0x33333333UL) << 2);
+	mask = ((mask >> 4) & 0x0F0F0F0FUL) | ((mask & 0x0F0F0F0FUL) << 4);
+	mask = ((mask >> 8) & 0x00FF00FFUL) | ((mask & 0x00FF00FFUL) << 8);
+	mask = ((mask >> 16) & 0x0000FFFFUL) | ((mask & 0x0000FFFFUL) << 16);
+	return mask;
+}
+/* }}} */
+
+/* LED update state machine {{{ */
+/**
+ * Finish the LED update in progress and tell the submitter about it.
+ */
+static void lpfk_upd_start(LPFK_CTX *ctx, const unsigned long mask,
+		LPFK_UPDATE_CB cb, void *user);
+
+static void lpfk_upd_complete(LPFK_CTX *ctx, const int result)
+{
+	LPFK_UPDATE_CB cb = ctx->upd_cb;
+	void *user = ctx->upd_user;
+
+	LPFK_PROBE2(update_done, ctx->upd_mask, result);
+
+	// remember what the LPFK is showing, so we don't send it again
+	if (result == LPFK_E_OK) {
+		ctx->shown_mask = ctx->upd_mask;
+		__atomic_store_n(&ctx->shown_valid, true, __ATOMIC_RELAXED);
+	} else {
+		__atomic_store_n(&ctx->shown_valid, false, __ATOMIC_RELAXED);
+	}
+
+	// back to idle before calling back, so the callback can start another
+	ctx->upd_state = LPFK_UPD_IDLE;
+	ctx->upd_result = result;
+	ctx->upd_cb = NULL;
+	ctx->upd_user = NULL;
+
+	if (cb != NULL) {
+		cb(ctx, result, user);
+	}
+
+	// a key was echoed while the LPFK was busy; send it now
+	if (ctx->echo_pending && (ctx->upd_state == LPFK_UPD_IDLE)) {
+		ctx->echo_pending = false;
+		lpfk_upd_start(ctx, lpfk_get_mask(ctx), NULL, NULL);
+	}
+}
+
+static void lpfk_upd_retry(LPFK_CTX *ctx);
+
+/**
+ * Transmit the LED update frame.
+ */
+static void lpfk_upd_send(LPFK_CTX *ctx)
+{
+	unsigned char buf[6];
+	int n = 0;
+
+	ctx->upd_attempt++;
+
+	// send any queued enable/disable in the same write
+	if (ctx->enable_want != ctx->enable_sent) {
+		buf[n++] = ctx->enable_want ? 0x08 : 0x09;
+	}
+	memcpy(&buf[n], ctx->upd_frame, 5);
+	n += 5;
+
+	if (lpfk_write(ctx, buf, n) < n) {
+		// no idea how much of it got there
+		ctx->enable_sent = -1;
+		lpfk_upd_retry(ctx);
+		return;
+	}
+	ctx->enable_sent = ctx->enable_want;
+	lpfk_stat_add(&ctx->stats.frames_tx, 1);
+	ctx->upd_sent = lpfk_time_ns();
+	LPFK_PROBE2(frame_send, ctx->upd_mask, ctx->upd_attempt);
+
+	// wait for response -- 0x81 = OK, 0x80 = retransmit
+	ctx->upd_state = LPFK_UPD_WAIT_ACK;
+	ctx->upd_deadline = lpfk_time_ms() + ctx->timing.ack_timeout_ms;
+}
+
+/**
+ * Retransmit the LED update frame after the backoff delay, or give up if
+ * we're out of attempts.
+ */
+static void lpfk_upd_retry(LPFK_CTX *ctx)
+{
+	int delay;
+
+	if (ctx->upd_attempt >= ctx->timing.ack_attempts) {
+		// LPFK never acknowledged the frame
+		lpfk_stat_add(&ctx->stats.update_failures, 1);
+		lpfk_upd_complete(ctx, LPFK_E_COMMS);
+		return;
+	}
+
+	delay = lpfk_backoff_ms(&ctx->timing, ctx->upd_attempt);
+	if (delay > 0) {
+		ctx->upd_state = LPFK_UPD_BACKOFF;
+		ctx->upd_deadline = lpfk_time_ms() + delay;
+	} else {
+		lpfk_upd_send(ctx);
+	}
+}
+
+/**
+ * Check whether a received byte is a response to a pending command, and act
+ * on it if it is.
+ *
+ * @return	true if the byte was consumed, false if it should be treated as
+ * 			a keycode.
+ */
+static bool lpfk_rx_response(LPFK_CTX *ctx, const unsigned char byte)
+{
+	if (byte == 0x81) {
+		// 0x81: received successfully
+		if (ctx->upd_state == LPFK_UPD_WAIT_ACK) {
+			long long latency = lpfk_time_ns() - ctx->upd_sent;
+			LPFK_PROBE2(response, byte, latency);
+			lpfk_stat_hist(ctx->stats.ack_latency, latency);
+			lpfk_upd_complete(ctx, LPFK_E_OK);
+		}
+		return true;
+	} else if (byte == 0x80) {
+		// 0x80: retransmit request
+		lpfk_stat_add(&ctx->stats.retransmits, 1);
+		LPFK_PROBE2(response, byte, lpfk_time_ns() - ctx->upd_sent);
+		LPFK_PROBE1(retransmit, ctx->upd_attempt);
+		if (ctx->upd_state == LPFK_UPD_WAIT_ACK) {
+			lpfk_upd_retry(ctx);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Retransmit the LED frame if the LPFK has taken too long to acknowledge it,
+ * or the backoff delay has expired.
+ */
+static void lpfk_echo_expire(LPFK_CTX *ctx);
+
+static void lpfk_check_timeouts(LPFK_CTX *ctx)
+{
+	lpfk_echo_expire(ctx);
+
+	if ((ctx->upd_state == LPFK_UPD_IDLE) ||
+			(lpfk_time_ms() < ctx->upd_deadline)) {
+		return;
+	}
+
+	if (ctx->upd_state == LPFK_UPD_WAIT_ACK) {
+		lpfk_stat_add(&ctx->stats.ack_timeouts, 1);
+		LPFK_PROBE1(ack_timeout, ctx->upd_attempt);
+		lpfk_upd_retry(ctx);
+	} else {
+		lpfk_upd_send(ctx);
+	}
+}
+
+/**
+ * Start sending an LED mask to the LPFK. If the LPFK is already showing it,
+ * the update completes straight away without going anywhere near the port.
+ */
+static void lpfk_upd_start(LPFK_CTX *ctx, const unsigned long mask,
+		LPFK_UPDATE_CB cb, void *user)
+{
+	unsigned long wire = lpfk_mask_to_wire(mask);
+
+	ctx->upd_mask = mask;
+	ctx->upd_attempt = 0;
+	ctx->upd_result = LPFK_E_BUSY;
+	ctx->upd_cb = cb;
+	ctx->upd_user = user;
+
+	if (__atomic_load_n(&ctx->shown_valid, __ATOMIC_RELAXED) &&
+			(mask == ctx->shown_mask)) {
+		lpfk_upd_complete(ctx, LPFK_E_OK);
+		return;
+	}
+
+	// build the frame from the LED mask
+	ctx->upd_frame[0] = 0x94;
+	ctx->upd_frame[1] = wire >> 24;
+	ctx->upd_frame[2] = wire >> 16;
+	ctx->upd_frame[3] = wire >> 8;
+	ctx->upd_frame[4] = wire & 0xff;
+
+	lpfk_upd_send(ctx);
+}
+/* }}} */
+
+/* Local echo {{{ */
+/**
+ * Send the cached LED mask after a local echo changed it: straight away if
+ * the LPFK is free, otherwise as soon as it is.
+ */
+static void lpfk_echo_send(LPFK_CTX *ctx)
+{
+	if (ctx->io != NULL) {
+		// the I/O thread sends the live mask when it sees a flush request
+		__atomic_add_fetch(&ctx->flush_gen, 1, __ATOMIC_SEQ_CST);
+		if (ctx->upd_state == LPFK_UPD_IDLE) {
+			lpfk_io_led_next(ctx);
+		}
+	} else if (ctx->upd_state == LPFK_UPD_IDLE) {
+		lpfk_upd_start(ctx, lpfk_get_mask(ctx), NULL, NULL);
+	} else {
+		ctx->echo_pending = true;
+	}
+}
+
+/**
+ * Apply the local echo policy for a key which has just been pressed.
+ */
+static void lpfk_echo_key(LPFK_CTX *ctx, const int key)
+{
+	int cfg = __atomic_load_n(&ctx->echo[key], __ATOMIC_RELAXED);
+	unsigned long group = 0;
+	int i;
+
+	switch (cfg & 0xff) {
+		case LPFK_ECHO_TOGGLE:
+			lpfk_modify_leds(ctx, 0, 0, LPFK_LED(key));
+			break;
+
+		case LPFK_ECHO_MOMENTARY:
+			lpfk_modify_leds(ctx, LPFK_LED(key), 0, 0);
+			ctx->echo_off[key] = lpfk_time_ms() + (cfg >> 8);
+			ctx->echo_timed |= LPFK_LED(key);
+			break;
+
+		case LPFK_ECHO_RADIO:
+			// every key set up as a radio button in the same group
+			for (i=0; i<32; i++) {
+				if (__atomic_load_n(&ctx->echo[i], __ATOMIC_RELAXED) == cfg) {
+					group |= LPFK_LED(i);
+				}
+			}
+			lpfk_modify_leds(ctx, LPFK_LED(key), group & ~LPFK_LED(key), 0);
+			break;
+
+		default:
+			return;
+	}
+
+	lpfk_echo_send(ctx);
+}
+
+/**
+ * Turn off momentary echoes which have been lit for long enough.
+ */
+static void lpfk_echo_expire(LPFK_CTX *ctx)
+{
+	unsigned long expired = 0;
+	long long now;
+	int i;
+
+	if (ctx->echo_timed == 0) {
+		return;
+	}
+
+	now = lpfk_time_ms();
+	for (i=0; i<32; i++) {
+		if ((ctx->echo_timed & LPFK_LED(i)) && (now >= ctx->echo_off[i])) {
+			expired |= LPFK_LED(i);
+		}
+	}
+
+	if (expired != 0) {
+		ctx->echo_timed &= ~expired;
+		lpfk_modify_leds(ctx, 0, expired, 0);
+		lpfk_echo_send(ctx);
+	}
+}
+/* }}} */
+
+/* Receive demultiplexer {{{ */
+/**
+ * Deal with a byte received from the LPFK. Responses are passed to the
+ * command waiting for them, and keycodes are added to the key queue.
+ *
+ * @return	true if a keycode was queued.
+ */
+static bool lpfk_rx_byte(LPFK_CTX *ctx, const unsigned char byte,
+		const struct timespec *ts)
+{
+	LPFK_KEY_EVENT ev;
+
+	if (lpfk_rx_response(ctx, byte)) {
+		return false;
+	}
+
+	if (byte > 31) {
+		// keycode invalid.
+		lpfk_stat_add(&ctx->stats.keys_invalid, 1);
+		LPFK_PROBE1(invalid, byte);
+		return false;
+	}
+
+	lpfk_stat_add(&ctx->stats.keys_rx, 1);
+	LPFK_PROBE1(key, byte);
+	ev.key = byte;
+	ev.time = *ts;
+
+	if (ctx->io != NULL) {
+		// hand the key over to the application thread
+		if (!lpfk_ring_push(&ctx->io->keys, &ev)) {
+			lpfk_stat_add(&ctx->stats.keys_dropped, 1);
+			return false;
+		}
+		lpfk_echo_key(ctx, byte);
+		return true;
+	}
+
+	// drop keys which arrive while the keyboard is disabled, or which
+	// don't fit in the queue
+	if (!ctx->enabled || ((ctx->keyq_head - ctx->keyq_tail) >= LPFK_KEYQ_SIZE)) {
+		lpfk_stat_add(&ctx->stats.keys_dropped, 1);
+		return false;
+	}
+
+	ctx->keyq[ctx->keyq_head % LPFK_KEYQ_SIZE] = ev;
+	ctx->keyq_head++;
+
+	// only echo keys the application will get, so the LEDs never show a
+	// press it didn't see
+	lpfk_echo_key(ctx, byte);
+	return true;
+}
+
+/**
+ * Read everything the LPFK has sent, in as few system calls as possible, and
+ * pass it through the demultiplexer.
+ *
+ * @return	Number of keycodes queued.
+ */
+static int lpfk_rx_pump(LPFK_CTX *ctx)
+{
+	unsigned char buf[64];
+	struct timespec ts;
+	int nbytes, i;
+	int queued = 0;
+
+	do {
+		nbytes = ctx->transport.ops->read(&ctx->transport, buf, sizeof(buf));
+		if (nbytes > 0) {
+			// everything in the burst shares a timestamp
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			lpfk_stat_add(&ctx->stats.bytes_rx, nbytes);
+			if (ctx->trace != NULL) {
+				lpfk_trace_record(ctx->trace, LPFK_TRACE_RX, lpfk_ts_ns(&ts), buf, nbytes);
+			}
+		}
+		for (i=0; i<nbytes; i++) {
+			if (lpfk_rx_byte(ctx, buf[i], &ts)) {
+				queued++;
+			}
+		}
+
+		// a short read means the input buffer is empty
+	} while (nbytes == sizeof(buf));
+
+	return queued;
+}
+/* }}} */
+
+/* lpfk_update_leds_async {{{ */
+int lpfk_update_leds_async(LPFK_CTX *ctx, LPFK_UPDATE_CB cb, void *user)
+{
+	// the I/O thread can't call back into the application
+	if (ctx->io != NULL) {
+		if (cb != NULL) {
+			return LPFK_E_PARAM;
+		}
+		return lpfk_io_submit(ctx, 0x94, lpfk_get_mask(ctx));
+	}
+
+	if (ctx->upd_state != LPFK_UPD_IDLE) {
+		return LPFK_E_BUSY;
+	}
+
+	lpfk_upd_start(ctx, lpfk_get_mask(ctx), cb, user);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_update_status {{{ */
+int lpfk_update_status(LPFK_CTX *ctx)
+{
+	if (ctx->io != NULL) {
+		return lpfk_io_update_status(ctx);
+	}
+
+	if (ctx->upd_state != LPFK_UPD_IDLE) {
+		return LPFK_E_BUSY;
+	}
+
+	return ctx->upd_result;
+}
+/* }}} */
+
+/* lpfk_process {{{ */
+int lpfk_process(LPFK_CTX *ctx)
+{
+	// the I/O thread does this for us
+	if (ctx->io != NULL) {
+		return LPFK_E_OK;
+	}
+
+	// handle anything the LPFK has sent
+	lpfk_rx_pump(ctx);
+	lpfk_check_timeouts(ctx);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_timeout {{{ */
+/**
+ * Time until lpfk_check_timeouts() next has something to do, for whichever
+ * thread owns the port.
+ */
+static int lpfk_next_timeout(LPFK_CTX *ctx)
+{
+	long long deadline = -1, remaining;
+	int rx, i;
+
+	if (ctx->upd_state != LPFK_UPD_IDLE) {
+		deadline = ctx->upd_deadline;
+	}
+
+	for (i=0; (ctx->echo_timed != 0) && (i<32); i++) {
+		if ((ctx->echo_timed & LPFK_LED(i)) &&
+				((deadline < 0) || (ctx->echo_off[i] < deadline))) {
+			deadline = ctx->echo_off[i];
+		}
+	}
+
+	// a transport with no descriptor to poll says when it will next have
+	// something for us
+	if (ctx->transport.ops->rx_timeout != NULL) {
+		rx = ctx->transport.ops->rx_timeout(&ctx->transport);
+		if ((rx >= 0) && ((deadline < 0) || (lpfk_time_ms() + rx < deadline))) {
+			deadline = lpfk_time_ms() + rx;
+		}
+	}
+
+	if (deadline < 0) {
+		return -1;
+	}
+
+	remaining = deadline - lpfk_time_ms();
+	return (remaining > 0) ? remaining : 0;
+}
+
+int lpfk_get_timeout(LPFK_CTX *ctx)
+{
+	// the I/O thread keeps track of its own timeouts
+	if (ctx->io != NULL) {
+		return -1;
+	}
+
+	return lpfk_next_timeout(ctx);
+}
+/* }}} */
+
+/* lpfk_update_leds {{{ */
+/**
+ * Sleep until the LPFK sends something or a timeout comes due, and deal with
+ * it. If the port has gone away, abandon the update in progress rather than
+ * waiting for every attempt to time out: poll() would return straight away
+ * each time round.
+ *
+ * @return	LPFK_E_OK, or LPFK_E_COMMS if the port hung up or broke.
+ */
+static int lpfk_upd_wait(LPFK_CTX *ctx, struct pollfd *pfd)
+{
+	int i;
+
+	i = poll(pfd, 1, lpfk_get_timeout(ctx));
+	if ((i < 0) && (errno == EINTR)) {
+		return LPFK_E_OK;
+	}
+
+	if ((i < 0) || ((i > 0) && (pfd->revents & (POLLERR | POLLHUP | POLLNVAL)))) {
+		if (ctx->upd_state != LPFK_UPD_IDLE) {
+			ctx->echo_pending = false;
+			lpfk_upd_complete(ctx, LPFK_E_COMMS);
+		}
+		return LPFK_E_COMMS;
+	}
+
+	lpfk_process(ctx);
+	return LPFK_E_OK;
+}
+
+int lpfk_update_leds(LPFK_CTX *ctx)
+{
+	struct pollfd pfd;
+
+	// queue the update for the I/O thread
+	if (ctx->io != NULL) {
+		return lpfk_io_submit(ctx, 0x94, lpfk_get_mask(ctx));
+	}
+
+	pfd.fd = ctx->transport.fd;
+	pfd.events = POLLIN;
+
+	// wait for any update already in progress, then start ours
+	while (lpfk_update_leds_async(ctx, NULL, NULL) == LPFK_E_BUSY) {
+		if (lpfk_upd_wait(ctx, &pfd) != LPFK_E_OK) {
+			return LPFK_E_COMMS;
+		}
+	}
+
+	// sleep until the LPFK responds or the ACK times out
+	while (ctx->upd_state != LPFK_UPD_IDLE) {
+		if (lpfk_upd_wait(ctx, &pfd) != LPFK_E_OK) {
+			return LPFK_E_COMMS;
+		}
+	}
+
+	return ctx->upd_result;
+}
+/* }}} */
+
+/* lpfk_flush_leds {{{ */
+int lpfk_flush_leds(LPFK_CTX *ctx)
+{
+	// ask the I/O thread for a flush. It picks it up straight away, or when
+	// it has finished the frame it's sending.
+	if (ctx->io != NULL) {
+		__atomic_add_fetch(&ctx->flush_gen, 1, __ATOMIC_SEQ_CST);
+		lpfk_efd_signal(ctx->io->cmd_efd);
+		return LPFK_E_OK;
+	}
+
+	// otherwise the port belongs to the application's thread, and sending
+	// from any other would race with it reading keys
+	if (!pthread_equal(pthread_self(), ctx->owner)) {
+		return LPFK_E_PARAM;
+	}
+
+	return lpfk_update_leds(ctx);
+}
+/* }}} */
+
+/* lpfk_flush_status {{{ */
+int lpfk_flush_status(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+
+	// lpfk_flush_leds() waited for the LPFK itself
+	if (io == NULL) {
+		return lpfk_update_status(ctx);
+	}
+
+	if (__atomic_load_n(&io->flush_done, __ATOMIC_ACQUIRE) !=
+			__atomic_load_n(&ctx->flush_gen, __ATOMIC_ACQUIRE)) {
+		return LPFK_E_BUSY;
+	}
+
+	return __atomic_load_n(&io->flush_result, __ATOMIC_RELAXED);
+}
+/* }}} */
+
+/* lpfk_set_led {{{ */
+int lpfk_set_led(LPFK_CTX *ctx, const int num, const int state)
+{
+	lpfk_set_led_cached(ctx, num, state);
+	return lpfk_update_leds(ctx);
+}
+/* }}} */
+
+/* lpfk_set_leds {{{ */
+int lpfk_set_leds(LPFK_CTX *ctx, const int state)
+{
+	lpfk_set_leds_cached(ctx, state);
+	return lpfk_update_leds(ctx);
+}
+/* }}} */
+
+/* lpfk_get_led {{{ */
+int lpfk_get_led(LPFK_CTX *ctx, const int num)
+{
+	// check parameters
+	if ((num < 0) || (num > 31)) {
+		return false;
+	}
+
+	if (lpfk_get_mask(ctx) & LPFK_LED(num)) {
+		return true;
+	} else {
+		return false;
+	}
+}
+/* }}} */
+
+/* lpfk_read {{{ */
+int lpfk_read(LPFK_CTX *ctx)
+{
+	LPFK_KEY_EVENT ev;
+	int n;
+
+	n = lpfk_read_batch(ctx, &ev, 1);
+	if (n < 0) {
+		// error
+		return n;
+	} else if (n == 0) {
+		// no keys buffered
+		return LPFK_E_NO_KEYS;
+	} else {
+		// key buffered, pass it along.
+		return ev.key;
+	}
+}
+/* }}} */
+
+/* lpfk_read_batch {{{ */
+int lpfk_read_batch(LPFK_CTX *ctx, LPFK_KEY_EVENT *events, const int max)
+{
+	int n, i;
+
+	if (max < 0) {
+		return LPFK_E_PARAM;
+	}
+
+	// make sure the LPFK is enabled before trying to read a scancode
+	if (!ctx->enabled) {
+		lpfk_process(ctx);
+		return LPFK_E_NOT_ENABLED;
+	}
+
+	if (ctx->io != NULL) {
+		// pick up keys queued by the I/O thread
+		n = lpfk_io_read(ctx, events, max);
+	} else {
+		// if the queue is empty, see what the LPFK has sent
+		if (ctx->keyq_head == ctx->keyq_tail) {
+			lpfk_process(ctx);
+		}
+
+		// pass the buffered keys along
+		for (n=0; (n < max) && (ctx->keyq_head != ctx->keyq_tail); n++) {
+			events[n] = ctx->keyq[ctx->keyq_tail % LPFK_KEYQ_SIZE];
+			ctx->keyq_tail++;
+		}
+	}
+
+	// how long did they wait?
+	if (n > 0) {
+		long long now = lpfk_time_ns();
+		for (i=0; i<n; i++) {
+			lpfk_stat_hist(ctx->stats.key_dwell, now - lpfk_ts_ns(&events[i].time));
+		}
+	}
+
+	return n;
+}
+/* }}} */
+
+
+/* lpfk_wait_key {{{ */
+int lpfk_wait_key(LPFK_CTX *ctx, const int timeout_ms)
+{
+	struct pollfd pfd;
+	long long deadline = 0;
+	int remaining, proto;
+	int key;
+	int i;
+
+	if (timeout_ms > 0) {
+		deadline = lpfk_time_ms() + timeout_ms;
+	}
+
+	pfd.fd = lpfk_get_fd(ctx);
+	pfd.events = POLLIN;
+
+	while (true) {
+		// check for a buffered key first; this also runs any protocol
+		// timeouts which have come due
+		key = lpfk_read(ctx);
+		if (key != LPFK_E_NO_KEYS) {
+			// keycode or error
+			return key;
+		}
+
+		// work out how long we can sleep for
+		if (timeout_ms < 0) {
+			remaining = -1;
+		} else if (timeout_ms == 0) {
+			return LPFK_E_NO_KEYS;
+		} else {
+			remaining = deadline - lpfk_time_ms();
+			if (remaining <= 0) {
+				return LPFK_E_NO_KEYS;
+			}
+		}
+
+		// wake up in time for ACK timeouts and retransmits as well
+		proto = lpfk_get_timeout(ctx);
+		if ((proto >= 0) && ((remaining < 0) || (proto < remaining))) {
+			remaining = proto;
+		}
+
+		// sleep until the LPFK sends something or something times out
+		i = poll(&pfd, 1, remaining);
+		if (i < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return LPFK_E_COMMS;
+		} else if ((i > 0) && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+			return LPFK_E_COMMS;
+		}
+	}
+}
+/* }}} */
+
+/* lpfk_set_echo {{{ */
+int lpfk_set_echo(LPFK_CTX *ctx, const int key, const int mode, const int param)
+{
+	if ((key < 0) || (key > 31) || (mode < LPFK_ECHO_NONE) ||
+			(mode > LPFK_ECHO_RADIO) || (param < 0) || (param > 0x7FFFFF)) {
+		return LPFK_E_PARAM;
+	}
+
+	// may be read by the I/O thread
+	__atomic_store_n(&ctx->echo[key],
+			mode | (((mode == LPFK_ECHO_MOMENTARY) || (mode == LPFK_ECHO_RADIO)) ? (param << 8) : 0),
+			__ATOMIC_RELAXED);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_get_fd {{{ */
+int lpfk_get_fd(LPFK_CTX *ctx)
+{
+	if (ctx->io != NULL) {
+		return ctx->io->key_efd;
+	}
+
+	return ctx->transport.fd;
+}
+/* }}} */
+
+/* I/O thread {{{ */
+/**
+ * Poke an eventfd.
+ */
+static void lpfk_efd_signal(const int efd)
+{
+	uint64_t one = 1;
+
+	write(efd, &one, sizeof(one));
+}
+
+/**
+ * LED update completion callback, called on the I/O thread. Sends the next
+ * LED mask if one came in while the last one was in flight.
+ */
+static void lpfk_io_led_done(LPFK_CTX *ctx, const int result, void *user)
+{
+	struct lpfk_iothread *io = user;
+
+	__atomic_store_n(&io->led_result, result, __ATOMIC_RELAXED);
+	__atomic_store_n(&io->led_done, io->sending_seq, __ATOMIC_RELEASE);
+	if (io->flush_sending) {
+		__atomic_store_n(&io->flush_result, result, __ATOMIC_RELAXED);
+		__atomic_store_n(&io->flush_done, io->flush_seen, __ATOMIC_RELEASE);
+	}
+
+	lpfk_io_led_next(ctx);
+}
+
+/**
+ * Start sending the next LED mask, if there is one. Called when the LPFK is
+ * free.
+ */
+static void lpfk_io_led_next(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+	unsigned int gen = __atomic_load_n(&ctx->flush_gen, __ATOMIC_ACQUIRE);
+	unsigned long mask;
+
+	if (gen != io->flush_seen) {
+		// lpfk_flush_leds() was called; the mask as it is now is at least
+		// as new as anything queued
+		io->flush_seen = gen;
+		io->flush_sending = true;
+		mask = lpfk_get_mask(ctx);
+	} else if (io->led_pending) {
+		io->flush_sending = false;
+		mask = io->pending_mask;
+	} else {
+		return;
+	}
+
+	io->led_pending = false;
+	io->sending_seq = io->pending_seq;
+	lpfk_upd_start(ctx, mask, lpfk_io_led_done, io);
+}
+
+/**
+ * Carry out the commands the application has queued.
+ *
+ * @return	false if the thread has been asked to stop.
+ */
+static bool lpfk_io_do_cmds(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+	LPFK_IO_CMD cmd;
+
+	while (lpfk_ring_pop(&io->cmds, &cmd)) {
+		switch (cmd.op) {
+			case 0:
+				// stop the thread
+				return false;
+
+			case 0x94:
+				// only the most recent LED mask matters
+				io->pending_mask = cmd.mask;
+				io->pending_seq = cmd.seq;
+				io->led_pending = true;
+				break;
+
+			default:
+				// enable/disable; only the last one matters
+				ctx->enable_want = (cmd.op == 0x08);
+				break;
+		}
+	}
+
+	// send the LED mask if the LPFK isn't busy with the last one, and any
+	// enable/disable with it (or on its own if there's no frame)
+	if (ctx->upd_state == LPFK_UPD_IDLE) {
+		lpfk_io_led_next(ctx);
+	}
+	lpfk_cmd_flush(ctx);
+
+	return true;
+}
+
+/**
+ * Read everything the LPFK has sent, and queue any keycodes.
+ */
+static void lpfk_io_do_rx(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+
+	// wake the application up if any keys were queued, unless it's already
+	// been woken
+	if ((lpfk_rx_pump(ctx) > 0) && !__atomic_exchange_n(&io->key_signalled, 1, __ATOMIC_SEQ_CST)) {
+		lpfk_efd_signal(io->key_efd);
+	}
+}
+
+/**
+ * I/O thread main loop.
+ */
+static void *lpfk_io_thread(void *arg)
+{
+	LPFK_CTX *ctx = arg;
+	struct lpfk_iothread *io = ctx->io;
+	struct pollfd pfd[2];
+	uint64_t val;
+
+	pfd[0].fd = ctx->transport.fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = io->cmd_efd;
+	pfd[1].events = POLLIN;
+
+	while (true) {
+		// sleep until the LPFK or the application wants something, or a
+		// protocol timeout expires
+		if (poll(pfd, 2, lpfk_next_timeout(ctx)) < 0) {
+			if (errno != EINTR) {
+				break;
+			}
+			continue;
+		}
+
+		if ((pfd[0].revents & POLLIN) || (ctx->transport.fd < 0)) {
+			lpfk_io_do_rx(ctx);
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			read(io->cmd_efd, &val, sizeof(val));
+			if (!lpfk_io_do_cmds(ctx)) {
+				break;
+			}
+		}
+
+		lpfk_check_timeouts(ctx);
+	}
+
+	return NULL;
+}
+
+/**
+ * Hand the serial port over to a new I/O thread.
+ */
+static int lpfk_io_start(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io;
+
+	io = calloc(1, sizeof(*io));
+	if (io == NULL) {
+		return LPFK_E_COMMS;
+	}
+
+	io->cmd_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	io->key_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	io->led_result = LPFK_E_OK;
+	io->flush_seen = ctx->flush_gen;
+	io->flush_done = ctx->flush_gen;
+	io->flush_result = LPFK_E_OK;
+
+	if ((io->cmd_efd < 0) || (io->key_efd < 0) ||
+			!lpfk_ring_init(&io->cmds, LPFK_IO_CMD_SLOTS, sizeof(LPFK_IO_CMD)) ||
+			!lpfk_ring_init(&io->keys, LPFK_IO_KEY_SLOTS, sizeof(LPFK_KEY_EVENT))) {
+		goto fail;
+	}
+
+	ctx->io = io;
+	if (pthread_create(&io->thread, NULL, lpfk_io_thread, ctx) != 0) {
+		ctx->io = NULL;
+		goto fail;
+	}
+
+	return LPFK_E_OK;
+
+fail:
+	if (io->cmd_efd >= 0) close(io->cmd_efd);
+	if (io->key_efd >= 0) close(io->key_efd);
+	free(io->cmds.buf);
+	free(io->keys.buf);
+	free(io);
+	return LPFK_E_COMMS;
+}
+
+/**
+ * Stop the I/O thread and take the serial port back.
+ */
+static void lpfk_io_stop(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+
+	// ask the thread to stop, making room in the queue if necessary
+	while (lpfk_io_submit(ctx, 0, 0) != LPFK_E_OK) {
+		lpfk_sleep_ms(1);
+	}
+	pthread_join(io->thread, NULL);
+
+	// the thread may have left an update in flight. Leave it there for
+	// this thread to see through, so its ACK -- in the buffer already, or
+	// still on the way -- isn't taken for the answer to the next frame;
+	// only the completion callback belonged to the thread.
+	ctx->upd_cb = NULL;
+	ctx->upd_user = NULL;
+	ctx->echo_pending = false;
+	ctx->io = NULL;
+
+	close(io->cmd_efd);
+	close(io->key_efd);
+	free(io->cmds.buf);
+	free(io->keys.buf);
+	free(io);
+}
+
+/**
+ * Queue a command for the I/O thread.
+ *
+ * @param	op		LPFK command byte, or 0 to stop the thread.
+ * @param	mask	LED mask, for 0x94.
+ * @return	LPFK_E_OK on success, LPFK_E_BUSY if the queue is full.
+ */
+static int lpfk_io_submit(LPFK_CTX *ctx, const int op, const unsigned long mask)
+{
+	struct lpfk_iothread *io = ctx->io;
+	LPFK_IO_CMD cmd;
+
+	cmd.op = op;
+	cmd.mask = mask;
+	cmd.seq = io->led_submitted + 1;
+
+	if (!lpfk_ring_push(&io->cmds, &cmd)) {
+		return LPFK_E_BUSY;
+	}
+
+	if (op == 0x94) {
+		io->led_submitted = cmd.seq;
+	}
+
+	lpfk_efd_signal(io->cmd_efd);
+	return LPFK_E_OK;
+}
+
+/**
+ * Take keys from the I/O thread's queue.
+ *
+ * @return	Number of key events read.
+ */
+static int lpfk_io_read(LPFK_CTX *ctx, LPFK_KEY_EVENT *events, const int max)
+{
+	struct lpfk_iothread *io = ctx->io;
+	uint64_t val;
+	int n = 0;
+
+	while ((n < max) && lpfk_ring_pop(&io->keys, &events[n])) {
+		n++;
+	}
+
+	if ((n > 0) || (max == 0)) {
+		return n;
+	}
+
+	// queue is empty -- clear the wakeup so poll() on key_efd sleeps until
+	// the thread queues another key, then look again in case one arrived in
+	// the meantime
+	if (__atomic_exchange_n(&io->key_signalled, 0, __ATOMIC_SEQ_CST)) {
+		read(io->key_efd, &val, sizeof(val));
+		while ((n < max) && lpfk_ring_pop(&io->keys, &events[n])) {
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Get the status of the most recently queued LED update.
+ */
+static int lpfk_io_update_status(LPFK_CTX *ctx)
+{
+	struct lpfk_iothread *io = ctx->io;
+
+	if (__atomic_load_n(&io->led_done, __ATOMIC_ACQUIRE) != io->led_submitted) {
+		return LPFK_E_BUSY;
+	}
+
+	return __atomic_load_n(&io->led_result, __ATOMIC_RELAXED);
+}
+/* }}} */
@@ -0,0 +1,296 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_anim.c
+ * @brief	liblpfk LED animation engine
+ */
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "liblpfk.h"
+#include "lpfk_anim.h"
+
+/**
+ * Get the current frame number: whole frame periods since the epoch.
+ */
+static unsigned long long lpfk_anim_now(LPFK_ANIM *anim)
+{
+	struct timespec ts;
+	long long ns;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ns = ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+	return ns / anim->period_ns;
+}
+
+/**
+ * Arm the frame timer to fire at the start of every frame, beginning with
+ * the next one.
+ *
+ * @return	Frame number of the next frame, or 0 on error.
+ */
+static unsigned long long lpfk_anim_arm(LPFK_ANIM *anim)
+{
+	struct itimerspec its;
+	unsigned long long next = lpfk_anim_now(anim) + 1;
+	long long ns = next * anim->period_ns;
+
+	its.it_value.tv_sec = ns / 1000000000LL;
+	its.it_value.tv_nsec = ns % 1000000000LL;
+	its.it_interval.tv_sec = anim->period_ns / 1000000000LL;
+	its.it_interval.tv_nsec = anim->period_ns % 1000000000LL;
+
+	// absolute deadlines don't accumulate error; and if someone sets the
+	// clock, we want to hear about it so we can line up with it again
+	if (timerfd_settime(anim->tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+				&its, NULL) < 0) {
+		return 0;
+	}
+
+	return next;
+}
+
+/* lpfk_anim_init {{{ */
+int lpfk_anim_init(LPFK_ANIM *anim, LPFK_CTX *ctx, const int period_ms)
+{
+	if (period_ms <= 0) {
+		return LPFK_E_PARAM;
+	}
+
+	memset(anim, 0, sizeof(*anim));
+	anim->ctx = ctx;
+	anim->period_ns = period_ms * 1000000LL;
+
+	anim->tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (anim->tfd < 0) {
+		return LPFK_E_COMMS;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_close {{{ */
+int lpfk_anim_close(LPFK_ANIM *anim)
+{
+	close(anim->tfd);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_set_sequence {{{ */
+int lpfk_anim_set_sequence(LPFK_ANIM *anim, const unsigned long *masks,
+		const int n, const int loop)
+{
+	if ((masks == NULL) || (n <= 0)) {
+		return LPFK_E_PARAM;
+	}
+
+	anim->seq = masks;
+	anim->nframes = n;
+	anim->loop = loop;
+	anim->gen = NULL;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_set_generator {{{ */
+int lpfk_anim_set_generator(LPFK_ANIM *anim, LPFK_ANIM_GEN gen, void *user)
+{
+	if (gen == NULL) {
+		return LPFK_E_PARAM;
+	}
+
+	anim->gen = gen;
+	anim->gen_user = user;
+	anim->seq = NULL;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_start {{{ */
+int lpfk_anim_start(LPFK_ANIM *anim)
+{
+	if ((anim->seq == NULL) && (anim->gen == NULL)) {
+		return LPFK_E_PARAM;
+	}
+
+	anim->start_frame = lpfk_anim_arm(anim);
+	if (anim->start_frame == 0) {
+		return LPFK_E_COMMS;
+	}
+
+	anim->frame = anim->start_frame - 1;
+	anim->shown = anim->dropped = 0;
+	anim->running = true;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_stop {{{ */
+int lpfk_anim_stop(LPFK_ANIM *anim)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(anim->tfd, 0, &its, NULL);
+	anim->running = false;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_anim_get_fd {{{ */
+int lpfk_anim_get_fd(LPFK_ANIM *anim)
+{
+	return anim->tfd;
+}
+/* }}} */
+
+/* lpfk_anim_process {{{ */
+int lpfk_anim_process(LPFK_ANIM *anim)
+{
+	unsigned long long frame, pos;
+	unsigned long mask;
+	uint64_t expirations;
+
+	if (!anim->running) {
+		return false;
+	}
+
+	if (read(anim->tfd, &expirations, sizeof(expirations)) < 0) {
+		if (errno == ECANCELED) {
+			// the clock was set; line up with it again, carrying on from
+			// the same place in a sequence which is only played once
+			pos = anim->frame - anim->start_frame;
+			frame = lpfk_anim_arm(anim);
+			anim->start_frame = frame - (pos + 1);
+			anim->frame = frame - 1;
+		}
+		// nothing due yet
+		return true;
+	}
+
+	// the frame is whichever one the clock says it is; anything between
+	// that and the last one we showed missed its slot
+	frame = lpfk_anim_now(anim);
+	if (frame <= anim->frame) {
+		// woken a hair early by the clock being slewed
+		frame = anim->frame + 1;
+	}
+	anim->dropped += frame - anim->frame - 1;
+	anim->frame = frame;
+
+	// work out what the frame looks like
+	if (anim->gen != NULL) {
+		if (!anim->gen(anim, frame, &mask, anim->gen_user)) {
+			lpfk_anim_stop(anim);
+			return false;
+		}
+	} else if (anim->loop) {
+		mask = anim->seq[frame % anim->nframes];
+	} else {
+		pos = frame - anim->start_frame;
+		if (pos >= (unsigned long long)anim->nframes) {
+			lpfk_anim_stop(anim);
+			return false;
+		}
+		mask = anim->seq[pos];
+	}
+
+	// and send it, unless the LPFK is still chewing on the last one. Look
+	// before touching the context's mask: lpfk_get_led() and local echo
+	// work from it, so it mustn't take a frame which is never sent. (The
+	// I/O thread queues frames rather than turning them away.)
+	if ((anim->ctx->io == NULL) && (lpfk_update_status(anim->ctx) == LPFK_E_BUSY)) {
+		anim->dropped++;
+		return true;
+	}
+
+	lpfk_set_mask(anim->ctx, mask);
+	if (lpfk_update_leds_async(anim->ctx, NULL, NULL) == LPFK_E_OK) {
+		anim->shown++;
+	} else {
+		anim->dropped++;
+	}
+
+	return true;
+}
+/* }}} */
+
+/* lpfk_anim_run {{{ */
+int lpfk_anim_run(LPFK_ANIM *anim)
+{
+	struct pollfd pfd[2];
+	int nfds;
+
+	pfd[0].fd = anim->tfd;
+	pfd[0].events = POLLIN;
+	// with an I/O thread, the LPFK looks after itself
+	pfd[1].fd = lpfk_get_fd(anim->ctx);
+	pfd[1].events = POLLIN;
+	nfds = (anim->ctx->io == NULL) ? 2 : 1;
+
+	// play the animation, then let the last frame finish
+	while (anim->running || ((anim->ctx->io == NULL) &&
+				(lpfk_update_status(anim->ctx) == LPFK_E_BUSY))) {
+		if (poll(pfd, nfds, lpfk_get_timeout(anim->ctx)) < 0) {
+			if (errno != EINTR) {
+				return LPFK_E_COMMS;
+			}
+			continue;
+		}
+
+		lpfk_process(anim->ctx);
+		if (anim->running) {
+			lpfk_anim_process(anim);
+		}
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
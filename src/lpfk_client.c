@@ -0,0 +1,188 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_client.c
+ * @brief	liblpfk client for the lpfkd daemon
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "liblpfk.h"
+#include "lpfk_client.h"
+
+/**
+ * Send a message to lpfkd.
+ */
+static int lpfk_client_send(LPFK_CLIENT *cl, const LPFKD_MSG *msg)
+{
+	ssize_t n;
+
+	do {
+		n = send(cl->fd, msg, sizeof(*msg), MSG_NOSIGNAL);
+	} while ((n < 0) && (errno == EINTR));
+
+	if (n == sizeof(*msg)) {
+		return LPFK_E_OK;
+	}
+
+	// a full socket buffer only means lpfkd is behind; it's still there
+	if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+		return LPFK_E_BUSY;
+	}
+
+	return LPFK_E_COMMS;
+}
+
+/* lpfk_client_open {{{ */
+int lpfk_client_open(LPFK_CLIENT *cl, const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (path == NULL) {
+		path = LPFKD_DEFAULT_SOCKET;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return LPFK_E_PARAM;
+	}
+	strcpy(addr.sun_path, path);
+
+	// SEQPACKET keeps the message boundaries, so there's no framing to do
+	cl->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (cl->fd < 0) {
+		return LPFK_E_NOT_PRESENT;
+	}
+
+	if (connect(cl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(cl->fd);
+		return LPFK_E_NOT_PRESENT;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_client_close {{{ */
+int lpfk_client_close(LPFK_CLIENT *cl)
+{
+	close(cl->fd);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_client_subscribe {{{ */
+int lpfk_client_subscribe(LPFK_CLIENT *cl, const unsigned long keys)
+{
+	LPFKD_MSG msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = LPFKD_OP_SUBSCRIBE;
+	msg.mask = keys;
+	return lpfk_client_send(cl, &msg);
+}
+/* }}} */
+
+/* lpfk_client_set {{{ */
+int lpfk_client_set(LPFK_CLIENT *cl, const unsigned long mask,
+		const unsigned long value, const unsigned long blink)
+{
+	LPFKD_MSG msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = LPFKD_OP_SET;
+	msg.mask = mask;
+	msg.value = value;
+	msg.blink = blink;
+	return lpfk_client_send(cl, &msg);
+}
+/* }}} */
+
+/* lpfk_client_release {{{ */
+int lpfk_client_release(LPFK_CLIENT *cl, const unsigned long mask)
+{
+	LPFKD_MSG msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = LPFKD_OP_RELEASE;
+	msg.mask = mask;
+	return lpfk_client_send(cl, &msg);
+}
+/* }}} */
+
+/* lpfk_client_read {{{ */
+int lpfk_client_read(LPFK_CLIENT *cl)
+{
+	LPFKD_MSG msg;
+	ssize_t n;
+
+	for (;;) {
+		n = recv(cl->fd, &msg, sizeof(msg), 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ?
+				LPFK_E_NO_KEYS : LPFK_E_COMMS;
+		} else if (n == 0) {
+			// lpfkd hung up
+			return LPFK_E_COMMS;
+		}
+
+		// skip anything this version doesn't understand
+		if ((n == sizeof(msg)) && (msg.op == LPFKD_OP_KEY) && (msg.key < 32)) {
+			return msg.key;
+		}
+	}
+}
+/* }}} */
+
+/* lpfk_client_get_fd {{{ */
+int lpfk_client_get_fd(LPFK_CLIENT *cl)
+{
+	return cl->fd;
+}
+/* }}} */
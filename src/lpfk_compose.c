@@ -0,0 +1,221 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_compose.c
+ * @brief	liblpfk layered LED compositor
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "liblpfk.h"
+#include "lpfk_anim.h"
+#include "lpfk_compose.h"
+
+/**
+ * Check a layer ID refers to a layer in use.
+ */
+static bool lpfk_compose_valid(LPFK_COMPOSITOR *comp, const int layer)
+{
+	return (layer >= 0) && (layer < LPFK_COMPOSE_MAX_LAYERS) &&
+		comp->layers[layer].used;
+}
+
+/* lpfk_compose_init {{{ */
+int lpfk_compose_init(LPFK_COMPOSITOR *comp, const int blink_frames)
+{
+	if (blink_frames < 1) {
+		return LPFK_E_PARAM;
+	}
+
+	memset(comp, 0, sizeof(*comp));
+	comp->blink_frames = blink_frames;
+	pthread_mutex_init(&comp->lock, NULL);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_compose_close {{{ */
+int lpfk_compose_close(LPFK_COMPOSITOR *comp)
+{
+	pthread_mutex_destroy(&comp->lock);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_compose_add_layer {{{ */
+int lpfk_compose_add_layer(LPFK_COMPOSITOR *comp, const int priority)
+{
+	int id, i;
+
+	pthread_mutex_lock(&comp->lock);
+
+	for (id=0; (id < LPFK_COMPOSE_MAX_LAYERS) && comp->layers[id].used; id++)
+		;
+	if (id == LPFK_COMPOSE_MAX_LAYERS) {
+		pthread_mutex_unlock(&comp->lock);
+		return LPFK_E_BUSY;
+	}
+
+	memset(&comp->layers[id], 0, sizeof(comp->layers[id]));
+	comp->layers[id].used = true;
+	comp->layers[id].priority = priority;
+
+	// keep the order list sorted so compositing is a single pass; new
+	// layers go after existing ones of the same priority
+	for (i=comp->nlayers; (i > 0) &&
+			(comp->layers[comp->order[i-1]].priority < priority); i--) {
+		comp->order[i] = comp->order[i-1];
+	}
+	comp->order[i] = id;
+	comp->nlayers++;
+
+	pthread_mutex_unlock(&comp->lock);
+	return id;
+}
+/* }}} */
+
+/* lpfk_compose_remove_layer {{{ */
+int lpfk_compose_remove_layer(LPFK_COMPOSITOR *comp, const int layer)
+{
+	int i;
+
+	pthread_mutex_lock(&comp->lock);
+
+	if (!lpfk_compose_valid(comp, layer)) {
+		pthread_mutex_unlock(&comp->lock);
+		return LPFK_E_PARAM;
+	}
+
+	comp->layers[layer].used = false;
+	for (i=0; comp->order[i] != layer; i++)
+		;
+	comp->nlayers--;
+	memmove(&comp->order[i], &comp->order[i+1],
+			(comp->nlayers - i) * sizeof(comp->order[0]));
+
+	pthread_mutex_unlock(&comp->lock);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_compose_set {{{ */
+int lpfk_compose_set(LPFK_COMPOSITOR *comp, const int layer,
+		const unsigned long mask, const unsigned long value,
+		const unsigned long blink)
+{
+	LPFK_LAYER *l;
+
+	pthread_mutex_lock(&comp->lock);
+
+	if (!lpfk_compose_valid(comp, layer)) {
+		pthread_mutex_unlock(&comp->lock);
+		return LPFK_E_PARAM;
+	}
+
+	l = &comp->layers[layer];
+	l->mask |= mask & LPFK_LED_ALL;
+	l->value = (l->value & ~mask) | (value & mask);
+	l->blink = (l->blink & ~mask) | (blink & mask);
+
+	pthread_mutex_unlock(&comp->lock);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_compose_release {{{ */
+int lpfk_compose_release(LPFK_COMPOSITOR *comp, const int layer,
+		const unsigned long mask)
+{
+	LPFK_LAYER *l;
+
+	pthread_mutex_lock(&comp->lock);
+
+	if (!lpfk_compose_valid(comp, layer)) {
+		pthread_mutex_unlock(&comp->lock);
+		return LPFK_E_PARAM;
+	}
+
+	l = &comp->layers[layer];
+	l->mask &= ~mask;
+	l->value &= ~mask;
+	l->blink &= ~mask;
+
+	pthread_mutex_unlock(&comp->lock);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_compose_mask {{{ */
+unsigned long lpfk_compose_mask(LPFK_COMPOSITOR *comp,
+		const unsigned long long frame)
+{
+	bool blink_on = ((frame / comp->blink_frames) % 2) == 0;
+	unsigned long claimed = 0, mask = 0, own, value;
+	LPFK_LAYER *l;
+	int i;
+
+	pthread_mutex_lock(&comp->lock);
+
+	// from the top down, each layer decides the LEDs it controls which no
+	// layer above it has already decided
+	for (i=0; i<comp->nlayers; i++) {
+		l = &comp->layers[comp->order[i]];
+		own = l->mask & ~claimed;
+		value = blink_on ? l->value : (l->value & ~l->blink);
+		mask |= value & own;
+		claimed |= own;
+	}
+
+	pthread_mutex_unlock(&comp->lock);
+	return mask;
+}
+/* }}} */
+
+/* lpfk_compose_generator {{{ */
+int lpfk_compose_generator(LPFK_ANIM *anim, const unsigned long long frame,
+		unsigned long *mask, void *user)
+{
+	(void)anim;
+	*mask = lpfk_compose_mask(user, frame);
+	return true;
+}
+/* }}} */
@@ -0,0 +1,175 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_dither.c
+ * @brief	liblpfk LED brightness by temporal dithering
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "liblpfk.h"
+#include "lpfk_dither.h"
+
+static void lpfk_dither_frame_done(LPFK_CTX *ctx, const int result, void *user);
+
+/**
+ * Work out the next frame and send it.
+ */
+static void lpfk_dither_send(LPFK_DITHER *dither)
+{
+	unsigned long mask = 0;
+	int i;
+
+	// first-order sigma-delta: light the LED whenever the accumulated
+	// brightness reaches a whole frame's worth
+	for (i=0; i<32; i++) {
+		dither->acc[i] += dither->level[i];
+		if (dither->acc[i] >= LPFK_DITHER_MAX) {
+			dither->acc[i] -= LPFK_DITHER_MAX;
+			mask |= LPFK_LED(i);
+		}
+	}
+
+	// the frame is our clock, so send it even if the LPFK is already
+	// showing this mask
+	lpfk_set_mask(dither->ctx, mask);
+	lpfk_invalidate_leds(dither->ctx);
+
+	dither->in_flight = true;
+	if (lpfk_update_leds_async(dither->ctx, lpfk_dither_frame_done, dither) != LPFK_E_OK) {
+		dither->in_flight = false;
+		dither->running = false;
+	}
+}
+
+/**
+ * LED update callback: the LPFK has the last frame, so send the next.
+ */
+static void lpfk_dither_frame_done(LPFK_CTX *ctx, const int result, void *user)
+{
+	LPFK_DITHER *dither = user;
+
+	(void)ctx;		// dither->ctx, which the next frame goes to anyway
+	dither->in_flight = false;
+	if (result != LPFK_E_OK) {
+		// the LPFK has stopped answering, even after retrying
+		dither->errors++;
+		dither->running = false;
+		return;
+	}
+	dither->frames++;
+
+	if (dither->running) {
+		lpfk_dither_send(dither);
+	}
+}
+
+/* lpfk_dither_init {{{ */
+int lpfk_dither_init(LPFK_DITHER *dither, LPFK_CTX *ctx)
+{
+	// needs update callbacks, which the I/O thread can't make
+	if (ctx->io != NULL) {
+		return LPFK_E_PARAM;
+	}
+
+	memset(dither, 0, sizeof(*dither));
+	dither->ctx = ctx;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_dither_set_level {{{ */
+int lpfk_dither_set_level(LPFK_DITHER *dither, const int led, const int level)
+{
+	if ((led < 0) || (led > 31) || (level < 0) || (level > LPFK_DITHER_MAX)) {
+		return LPFK_E_PARAM;
+	}
+
+	dither->level[led] = level;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_dither_set_levels {{{ */
+int lpfk_dither_set_levels(LPFK_DITHER *dither, const unsigned char *levels)
+{
+	memcpy(dither->level, levels, sizeof(dither->level));
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_dither_get_level {{{ */
+int lpfk_dither_get_level(LPFK_DITHER *dither, const int led)
+{
+	if ((led < 0) || (led > 31)) {
+		return LPFK_E_PARAM;
+	}
+
+	return dither->level[led];
+}
+/* }}} */
+
+/* lpfk_dither_start {{{ */
+int lpfk_dither_start(LPFK_DITHER *dither)
+{
+	if (dither->running) {
+		return LPFK_E_OK;
+	}
+
+	if (dither->in_flight || (lpfk_update_status(dither->ctx) == LPFK_E_BUSY)) {
+		// still finishing off something else
+		return LPFK_E_BUSY;
+	}
+
+	dither->running = true;
+	lpfk_dither_send(dither);
+	return dither->running ? LPFK_E_OK : LPFK_E_BUSY;
+}
+/* }}} */
+
+/* lpfk_dither_stop {{{ */
+int lpfk_dither_stop(LPFK_DITHER *dither)
+{
+	dither->running = false;
+	return LPFK_E_OK;
+}
+/* }}} */
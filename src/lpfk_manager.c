@@ -0,0 +1,395 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_manager.c
+ * @brief	liblpfk multi-device manager
+ */
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "liblpfk.h"
+#include "lpfk_manager.h"
+
+/// Maximum number of epoll events handled per loop iteration
+#define LPFK_MGR_MAX_EVENTS	32
+
+/// Managed device
+struct lpfk_mgr_dev {
+	LPFK_MANAGER	*mgr;		///< manager which owns this device
+	int				id;			///< device ID
+	LPFK_CTX		ctx;		///< LPFK context
+	bool			dirty;		///< LED state changed during an update
+	bool			failed;		///< device has stopped responding
+	bool			removed;	///< device removed, waiting to be freed
+	struct lpfk_mgr_dev	*next;	///< next device on the removed list
+};
+
+/* lpfk_manager_init {{{ */
+int lpfk_manager_init(LPFK_MANAGER *mgr)
+{
+	memset(mgr, 0, sizeof(*mgr));
+
+	mgr->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mgr->epfd < 0) {
+		return LPFK_E_COMMS;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_manager_close {{{ */
+int lpfk_manager_close(LPFK_MANAGER *mgr)
+{
+	int i;
+
+	for (i=0; i<mgr->ndevs; i++) {
+		lpfk_manager_remove(mgr, i);
+	}
+
+	free(mgr->devs);
+	mgr->devs = NULL;
+	mgr->ndevs = 0;
+
+	close(mgr->epfd);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_manager_add {{{ */
+int lpfk_manager_add(LPFK_MANAGER *mgr, const char *port,
+		const LPFK_OPTIONS *opts)
+{
+	struct lpfk_mgr_dev *dev, **devs;
+	struct epoll_event ev;
+	int id, i;
+
+	// the manager drives the LED updates itself, with completion callbacks
+	// the I/O thread can't make
+	if ((opts != NULL) && (opts->flags & LPFK_OPT_IO_THREAD)) {
+		return LPFK_E_PARAM;
+	}
+
+	// opening blocks until the LPFK answers, which would stall every other
+	// device if done from a callback
+	if (mgr->running) {
+		return LPFK_E_BUSY;
+	}
+
+	// find a free device ID, making room for a new one if necessary
+	for (id=0; id<mgr->ndevs; id++) {
+		if (mgr->devs[id] == NULL) {
+			break;
+		}
+	}
+	if (id == mgr->ndevs) {
+		devs = realloc(mgr->devs, (mgr->ndevs + 1) * sizeof(*devs));
+		if (devs == NULL) {
+			return LPFK_E_PARAM;
+		}
+		devs[id] = NULL;
+		mgr->devs = devs;
+		mgr->ndevs++;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return LPFK_E_PARAM;
+	}
+	dev->mgr = mgr;
+	dev->id = id;
+
+	// open the LPFK
+	if ((i = lpfk_open_ex(&dev->ctx, port, opts)) != LPFK_E_OK) {
+		free(dev);
+		return i;
+	}
+
+	// add it to the event loop
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = dev;
+	if (epoll_ctl(mgr->epfd, EPOLL_CTL_ADD, lpfk_get_fd(&dev->ctx), &ev) < 0) {
+		lpfk_close(&dev->ctx);
+		free(dev);
+		return LPFK_E_COMMS;
+	}
+
+	mgr->devs[id] = dev;
+	return id;
+}
+/* }}} */
+
+/* lpfk_mgr_get_dev {{{ */
+/**
+ * Look up a device by ID.
+ */
+static struct lpfk_mgr_dev *lpfk_mgr_get_dev(LPFK_MANAGER *mgr, const int dev)
+{
+	if ((dev < 0) || (dev >= mgr->ndevs)) {
+		return NULL;
+	}
+
+	return mgr->devs[dev];
+}
+/* }}} */
+
+/* lpfk_manager_remove {{{ */
+int lpfk_manager_remove(LPFK_MANAGER *mgr, const int dev)
+{
+	struct lpfk_mgr_dev *d = lpfk_mgr_get_dev(mgr, dev);
+
+	if (d == NULL) {
+		return LPFK_E_PARAM;
+	}
+
+	// a device which has gone away would only time out on every frame
+	// lpfk_close() sends, holding up the rest
+	if (!d->failed) {
+		epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, lpfk_get_fd(&d->ctx), NULL);
+		lpfk_close(&d->ctx);
+	} else {
+		lpfk_abandon(&d->ctx);
+	}
+	mgr->devs[dev] = NULL;
+
+	// events for this device may still be queued up in lpfk_manager_run(),
+	// so don't free it until that's finished with them
+	if (mgr->running) {
+		d->removed = true;
+		d->next = mgr->removed;
+		mgr->removed = d;
+	} else {
+		free(d);
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_manager_ctx {{{ */
+LPFK_CTX *lpfk_manager_ctx(LPFK_MANAGER *mgr, const int dev)
+{
+	struct lpfk_mgr_dev *d = lpfk_mgr_get_dev(mgr, dev);
+
+	return (d != NULL) ? &d->ctx : NULL;
+}
+/* }}} */
+
+/* lpfk_mgr_led_done {{{ */
+/**
+ * LED update completion callback. Sends the LED state again if it changed
+ * while the update was in progress.
+ */
+static void lpfk_mgr_led_done(LPFK_CTX *ctx, const int result, void *user)
+{
+	struct lpfk_mgr_dev *d = user;
+	LPFK_MANAGER *mgr = d->mgr;
+
+	if (d->dirty && !d->failed) {
+		d->dirty = false;
+		lpfk_update_leds_async(ctx, lpfk_mgr_led_done, d);
+	}
+
+	if (mgr->led_cb != NULL) {
+		mgr->led_cb(mgr, d->id, result, mgr->led_user);
+	}
+}
+/* }}} */
+
+/* lpfk_manager_update_leds {{{ */
+int lpfk_manager_update_leds(LPFK_MANAGER *mgr, const int dev)
+{
+	struct lpfk_mgr_dev *d = lpfk_mgr_get_dev(mgr, dev);
+	int err;
+
+	if (d == NULL) {
+		return LPFK_E_PARAM;
+	}
+
+	// if an update is in flight, send the new state when it completes
+	err = lpfk_update_leds_async(&d->ctx, lpfk_mgr_led_done, d);
+	if (err == LPFK_E_BUSY) {
+		d->dirty = true;
+		return LPFK_E_OK;
+	}
+
+	return err;
+}
+/* }}} */
+
+/* lpfk_manager_set_key_cb {{{ */
+void lpfk_manager_set_key_cb(LPFK_MANAGER *mgr, LPFK_MGR_KEY_CB cb, void *user)
+{
+	mgr->key_cb = cb;
+	mgr->key_user = user;
+}
+/* }}} */
+
+/* lpfk_manager_set_led_cb {{{ */
+void lpfk_manager_set_led_cb(LPFK_MANAGER *mgr, LPFK_MGR_LED_CB cb, void *user)
+{
+	mgr->led_cb = cb;
+	mgr->led_user = user;
+}
+/* }}} */
+
+/* lpfk_mgr_service {{{ */
+/**
+ * Read any keys waiting on a device, and drive its pending LED update.
+ */
+static void lpfk_mgr_service(struct lpfk_mgr_dev *d)
+{
+	LPFK_MANAGER *mgr = d->mgr;
+	int key;
+
+	// lpfk_read() also handles LED update responses and timeouts
+	while (!d->removed && ((key = lpfk_read(&d->ctx)) >= 0)) {
+		if (mgr->key_cb != NULL) {
+			mgr->key_cb(mgr, d->id, key, mgr->key_user);
+		}
+	}
+}
+/* }}} */
+
+/* lpfk_mgr_fail {{{ */
+/**
+ * Take a device which has gone away out of the event loop.
+ */
+static void lpfk_mgr_fail(struct lpfk_mgr_dev *d)
+{
+	LPFK_MANAGER *mgr = d->mgr;
+
+	epoll_ctl(mgr->epfd, EPOLL_CTL_DEL, lpfk_get_fd(&d->ctx), NULL);
+	d->failed = true;
+
+	if (mgr->key_cb != NULL) {
+		mgr->key_cb(mgr, d->id, LPFK_E_COMMS, mgr->key_user);
+	}
+}
+/* }}} */
+
+/* lpfk_manager_get_timeout {{{ */
+int lpfk_manager_get_timeout(LPFK_MANAGER *mgr)
+{
+	int timeout = -1;
+	int i, t;
+
+	for (i=0; i<mgr->ndevs; i++) {
+		if ((mgr->devs[i] == NULL) || mgr->devs[i]->failed) {
+			continue;
+		}
+
+		t = lpfk_get_timeout(&mgr->devs[i]->ctx);
+		if ((t >= 0) && ((timeout < 0) || (t < timeout))) {
+			timeout = t;
+		}
+	}
+
+	return timeout;
+}
+/* }}} */
+
+/* lpfk_manager_run {{{ */
+int lpfk_manager_run(LPFK_MANAGER *mgr, const int timeout_ms)
+{
+	struct epoll_event events[LPFK_MGR_MAX_EVENTS];
+	struct lpfk_mgr_dev *d;
+	int timeout;
+	int i, n;
+
+	// wake up in time for the next protocol timeout
+	timeout = lpfk_manager_get_timeout(mgr);
+	if ((timeout < 0) || ((timeout_ms >= 0) && (timeout_ms < timeout))) {
+		timeout = timeout_ms;
+	}
+
+	n = epoll_wait(mgr->epfd, events, LPFK_MGR_MAX_EVENTS, timeout);
+	if (n < 0) {
+		return (errno == EINTR) ? LPFK_E_OK : LPFK_E_COMMS;
+	}
+
+	mgr->running = true;
+
+	// service the LPFKs which have sent us something
+	for (i=0; i<n; i++) {
+		d = events[i].data.ptr;
+		if (d->removed || d->failed) {
+			continue;
+		} else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			lpfk_mgr_fail(d);
+		} else {
+			lpfk_mgr_service(d);
+		}
+	}
+
+	// and handle timeouts on the rest
+	for (i=0; i<mgr->ndevs; i++) {
+		d = mgr->devs[i];
+		if ((d != NULL) && !d->failed && (lpfk_get_timeout(&d->ctx) == 0)) {
+			lpfk_mgr_service(d);
+		}
+	}
+
+	mgr->running = false;
+
+	// free any devices the callbacks removed
+	while (mgr->removed != NULL) {
+		d = mgr->removed;
+		mgr->removed = d->next;
+		free(d);
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_manager_get_fd {{{ */
+int lpfk_manager_get_fd(LPFK_MANAGER *mgr)
+{
+	return mgr->epfd;
+}
+/* }}} */
@@ -0,0 +1,80 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_probes.h
+ * @brief	liblpfk static tracepoints
+ *
+ * Build with "make USDT=1" to turn these into USDT probes (provider
+ * "liblpfk"), which bpftrace, perf and SystemTap can attach to at run time.
+ * Otherwise they compile to nothing. Needs sys/sdt.h from SystemTap.
+ *
+ * Probes:
+ *  - open_start(port)				lpfk_open_ex() or lpfk_open_transport()
+ *  								called; port is NULL for the latter
+ *  - probe_send(attempt)			READ CONFIGURATION probe sent
+ *  - open_done(result, probes)		open finished
+ *  - cmd_write(byte, len, result)	write to the LPFK; byte is the first byte
+ *  - frame_send(mask, attempt)		LED frame sent
+ *  - response(byte, latency_ns)	0x80/0x81 received; latency from frame sent
+ *  - retransmit(attempt)			LPFK asked for the LED frame again
+ *  - ack_timeout(attempt)			LPFK didn't answer the LED frame in time
+ *  - update_done(mask, result)		LED update finished
+ *  - key(key)						keycode decoded
+ *  - invalid(byte)					byte which wasn't a keycode or response
+ */
+
+#ifndef _lpfk_probes_h_included
+#define _lpfk_probes_h_included
+
+#ifdef LPFK_USDT
+#include <sys/sdt.h>
+
+#define LPFK_PROBE1(name, a)		DTRACE_PROBE1(liblpfk, name, a)
+#define LPFK_PROBE2(name, a, b)		DTRACE_PROBE2(liblpfk, name, a, b)
+#define LPFK_PROBE3(name, a, b, c)	DTRACE_PROBE3(liblpfk, name, a, b, c)
+#else
+// still evaluate the arguments, so values only traced don't look unused
+#define LPFK_PROBE1(name, a)		do { (void)(a); } while (0)
+#define LPFK_PROBE2(name, a, b)		do { (void)(a); (void)(b); } while (0)
+#define LPFK_PROBE3(name, a, b, c)	do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif // _lpfk_probes_h_included
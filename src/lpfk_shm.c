@@ -0,0 +1,328 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_shm.c
+ * @brief	liblpfk shared-memory LED framebuffer
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "liblpfk.h"
+#include "lpfk_shm.h"
+
+/// Time one LED frame takes on the wire: 5 bytes of 11 bits at 9600 baud.
+/// lpfk_flush_leds() hands the frame to the I/O thread without waiting for
+/// it, so the flusher checks for the LPFK's answer this often.
+#define LPFK_SHM_FRAME_NS	5729167L
+
+/**
+ * Sleep on a futex in the segment until its value isn't val. The futex is
+ * shared between processes, so the private futex ops can't be used.
+ */
+static void lpfk_shm_futex_wait(uint32_t *addr, const uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void lpfk_shm_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Check a segment name is one shm_open() will take, and fits in the handle.
+ */
+static bool lpfk_shm_name_valid(const char *name)
+{
+	return (name != NULL) && (name[0] == '/') && (name[1] != '\0') &&
+		(strchr(name + 1, '/') == NULL) && (strlen(name) < LPFK_PATH_MAX);
+}
+
+/**
+ * Tell the flusher the mask has changed, waking it if it's asleep.
+ */
+static void lpfk_shm_kick(LPFK_SHM_SEG *seg)
+{
+	__atomic_add_fetch(&seg->gen, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&seg->waiting, 0, __ATOMIC_SEQ_CST)) {
+		lpfk_shm_futex_wake(&seg->gen);
+	}
+}
+
+/**
+ * Publish what the flusher just did, under the status seqlock.
+ */
+static void lpfk_shm_publish(LPFK_SHM_SEG *seg, const uint32_t shown,
+		const int result)
+{
+	struct timespec ts;
+	uint32_t seq = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	__atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&seg->shown, shown, __ATOMIC_RELAXED);
+	__atomic_store_n(&seg->result, result, __ATOMIC_RELAXED);
+	__atomic_store_n(&seg->flushes,
+			__atomic_load_n(&seg->flushes, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&seg->time_ns,
+			((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Flusher thread: copy the segment's mask to the LPFK whenever it changes.
+ */
+static void *lpfk_shm_flusher(void *arg)
+{
+	LPFK_SHM *shm = arg;
+	LPFK_SHM_SEG *seg = shm->seg;
+	struct timespec frame = { 0, LPFK_SHM_FRAME_NS };
+	uint32_t seen, gen, mask;
+	int result;
+
+	// the mask the segment started with hasn't been sent yet
+	seen = __atomic_load_n(&seg->gen, __ATOMIC_SEQ_CST) - 1;
+
+	while (!__atomic_load_n(&shm->stop, __ATOMIC_SEQ_CST)) {
+		gen = __atomic_load_n(&seg->gen, __ATOMIC_SEQ_CST);
+		if (gen == seen) {
+			// nothing to do. Say we're going to sleep before looking at
+			// gen for the last time, so a writer which changes it after
+			// that is sure to see the flag and wake us.
+			__atomic_store_n(&seg->waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&seg->gen, __ATOMIC_SEQ_CST) == seen) {
+				lpfk_shm_futex_wait(&seg->gen, seen);
+			}
+			continue;
+		}
+
+		seen = gen;
+		mask = __atomic_load_n(&seg->mask, __ATOMIC_SEQ_CST);
+		lpfk_set_mask(shm->ctx, mask);
+		result = lpfk_flush_leds(shm->ctx);
+
+		// wait for the LPFK to answer, checking once a frame; this also
+		// paces us to the line speed, and changes made meanwhile go out
+		// together in the next frame
+		if (result == LPFK_E_OK) {
+			while ((result = lpfk_flush_status(shm->ctx)) == LPFK_E_BUSY) {
+				if (__atomic_load_n(&shm->stop, __ATOMIC_SEQ_CST)) {
+					return NULL;
+				}
+				nanosleep(&frame, NULL);
+			}
+		}
+		lpfk_shm_publish(seg, mask, result);
+	}
+
+	return NULL;
+}
+
+/**
+ * Map a segment.
+ */
+static LPFK_SHM_SEG *lpfk_shm_map(const int fd)
+{
+	void *p = mmap(NULL, sizeof(LPFK_SHM_SEG), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* lpfk_shm_create {{{ */
+int lpfk_shm_create(LPFK_SHM *shm, LPFK_CTX *ctx, const char *name,
+		const mode_t mode)
+{
+	int fd;
+
+	// the flusher sends from its own thread, which only the I/O thread
+	// makes safe alongside the application reading keys
+	if (!lpfk_shm_name_valid(name) || (ctx->io == NULL)) {
+		return LPFK_E_PARAM;
+	}
+
+	memset(shm, 0, sizeof(*shm));
+	strcpy(shm->name, name);
+	shm->ctx = ctx;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+	if (fd < 0) {
+		return (errno == EEXIST) ? LPFK_E_BUSY : LPFK_E_COMMS;
+	}
+
+	if ((ftruncate(fd, sizeof(LPFK_SHM_SEG)) < 0) ||
+			((shm->seg = lpfk_shm_map(fd)) == NULL)) {
+		close(fd);
+		shm_unlink(name);
+		return LPFK_E_COMMS;
+	}
+	close(fd);
+
+	// ftruncate() zeroed the segment; publish the magic number last, so
+	// anyone attaching sees a segment which is ready to use
+	shm->seg->mask = lpfk_get_mask(ctx);
+	shm->seg->result = LPFK_E_OK;
+	__atomic_store_n(&shm->seg->magic, LPFK_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	if (pthread_create(&shm->thread, NULL, lpfk_shm_flusher, shm) != 0) {
+		munmap(shm->seg, sizeof(LPFK_SHM_SEG));
+		shm_unlink(name);
+		return LPFK_E_COMMS;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_shm_attach {{{ */
+int lpfk_shm_attach(LPFK_SHM *shm, const char *name)
+{
+	struct stat st;
+	int fd;
+
+	if (!lpfk_shm_name_valid(name)) {
+		return LPFK_E_PARAM;
+	}
+
+	memset(shm, 0, sizeof(*shm));
+	strcpy(shm->name, name);
+
+	fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return LPFK_E_NOT_PRESENT;
+	}
+
+	// a segment that's too small is someone else's, or still being made
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(LPFK_SHM_SEG)) ||
+			((shm->seg = lpfk_shm_map(fd)) == NULL)) {
+		close(fd);
+		return LPFK_E_NOT_PRESENT;
+	}
+	close(fd);
+
+	if (__atomic_load_n(&shm->seg->magic, __ATOMIC_ACQUIRE) != LPFK_SHM_MAGIC) {
+		munmap(shm->seg, sizeof(LPFK_SHM_SEG));
+		return LPFK_E_NOT_PRESENT;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_shm_close {{{ */
+int lpfk_shm_close(LPFK_SHM *shm)
+{
+	if (shm->ctx != NULL) {
+		__atomic_store_n(&shm->stop, true, __ATOMIC_SEQ_CST);
+		lpfk_shm_kick(shm->seg);
+		pthread_join(shm->thread, NULL);
+		shm_unlink(shm->name);
+	}
+
+	munmap(shm->seg, sizeof(LPFK_SHM_SEG));
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_shm_set_mask {{{ */
+int lpfk_shm_set_mask(LPFK_SHM *shm, const unsigned long mask)
+{
+	__atomic_store_n(&shm->seg->mask, (uint32_t)mask, __ATOMIC_SEQ_CST);
+	lpfk_shm_kick(shm->seg);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_shm_modify {{{ */
+int lpfk_shm_modify(LPFK_SHM *shm, const unsigned long set,
+		const unsigned long clear, const unsigned long toggle)
+{
+	uint32_t old, new;
+
+	old = __atomic_load_n(&shm->seg->mask, __ATOMIC_RELAXED);
+	do {
+		new = ((old | set) & ~clear) ^ toggle;
+	} while (!__atomic_compare_exchange_n(&shm->seg->mask, &old, new, true,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	lpfk_shm_kick(shm->seg);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_shm_get_mask {{{ */
+unsigned long lpfk_shm_get_mask(LPFK_SHM *shm)
+{
+	return __atomic_load_n(&shm->seg->mask, __ATOMIC_SEQ_CST);
+}
+/* }}} */
+
+/* lpfk_shm_get_status {{{ */
+int lpfk_shm_get_status(LPFK_SHM *shm, LPFK_SHM_STATUS *status)
+{
+	LPFK_SHM_SEG *seg = shm->seg;
+	uint32_t seq;
+
+	// retry until we read the block without the flusher writing it
+	do {
+		while ((seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		status->shown = __atomic_load_n(&seg->shown, __ATOMIC_RELAXED);
+		status->result = __atomic_load_n(&seg->result, __ATOMIC_RELAXED);
+		status->flushes = __atomic_load_n(&seg->flushes, __ATOMIC_RELAXED);
+		status->time_ns = __atomic_load_n(&seg->time_ns, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) != seq);
+
+	return LPFK_E_OK;
+}
+/* }}} */
@@ -0,0 +1,789 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_sim.c
+ * @brief	liblpfk LPFK simulator
+ */
+
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "liblpfk.h"
+#include "lpfk_sim.h"
+
+/* Helpers {{{ */
+/**
+ * Get the current time on the monotonic clock, in nanoseconds.
+ */
+static long long lpfk_sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/**
+ * Convert an LED frame payload (LED 0 in the MSB) to a natural-order mask.
+ */
+static unsigned long lpfk_sim_wire_to_mask(const unsigned char *frame)
+{
+	unsigned long wire, mask = 0;
+	int i;
+
+	wire = ((unsigned long)frame[0] << 24) | ((unsigned long)frame[1] << 16) |
+		((unsigned long)frame[2] << 8) | frame[3];
+
+	for (i=0; i<32; i++) {
+		if (wire & (0x80000000UL >> i)) {
+			mask |= LPFK_LED(i);
+		}
+	}
+
+	return mask;
+}
+
+/**
+ * Wake the simulator thread so it notices a new keypress or a stop request.
+ */
+static void lpfk_sim_wake(LPFK_SIM *sim)
+{
+	uint64_t one = 1;
+
+	if (write(sim->wake_efd, &one, sizeof(one)) < 0) {
+		// counter saturated; the thread is being woken anyway
+	}
+}
+/* }}} */
+
+/* Serial line model {{{ */
+/**
+ * Time one byte takes to cross the line, in nanoseconds.
+ */
+static long long lpfk_sim_char_ns(LPFK_SIM *sim)
+{
+	return (sim->opts.flags & LPFK_SIM_LINE_TIMING) ? LPFK_SIM_CHAR_NS : 0;
+}
+
+/**
+ * Queue a byte to be sent to the host. The LPFK starts sending it
+ * latency_us after the event which caused it, or when the line is next
+ * idle, whichever is later.
+ */
+static void lpfk_sim_send(LPFK_SIM *sim, const unsigned char byte, const long long when)
+{
+	long long start = when + (sim->opts.latency_us * 1000LL);
+
+	if ((sim->txq_head - sim->txq_tail) >= LPFK_SIM_LINE_SLOTS) {
+		// the host isn't reading; a real LPFK would lose it too
+		return;
+	}
+
+	if (start < sim->tx_free) {
+		start = sim->tx_free;
+	}
+	sim->tx_free = start + lpfk_sim_char_ns(sim);
+
+	sim->txq[sim->txq_head % LPFK_SIM_LINE_SLOTS].byte = byte;
+	sim->txq[sim->txq_head % LPFK_SIM_LINE_SLOTS].due = sim->tx_free;
+	sim->txq_head++;
+}
+
+/**
+ * Act on a byte from the host, which finished arriving at time 'when'.
+ */
+static void lpfk_sim_rx_byte(LPFK_SIM *sim, const unsigned char byte, const long long when)
+{
+	// middle of an LED frame?
+	if (sim->frame_len > 0) {
+		sim->frame[sim->frame_len++] = byte;
+		if (sim->frame_len < 5) {
+			return;
+		}
+
+		sim->frame_len = 0;
+		sim->frames++;
+
+		if ((sim->opts.ack_drop_every > 0) &&
+				((sim->frames % sim->opts.ack_drop_every) == 0)) {
+			// lost on the line; the host will have to time out
+			return;
+		}
+
+		if ((sim->opts.nak_every > 0) &&
+				((sim->frames % sim->opts.nak_every) == 0)) {
+			// 0x80: please retransmit
+			lpfk_sim_send(sim, 0x80, when);
+			return;
+		}
+
+		sim->led_mask = lpfk_sim_wire_to_mask(&sim->frame[1]);
+		lpfk_sim_send(sim, 0x81, when);
+
+		if (sim->led_cb != NULL) {
+			sim->led_cb(sim, sim->led_mask, sim->led_user);
+		}
+		return;
+	}
+
+	switch (byte) {
+		case 0x06:
+			// READ CONFIGURATION; we're an LPFK
+			sim->probes++;
+			lpfk_sim_send(sim, 0x03, when);
+			break;
+
+		case 0x08:
+			// enable keyboard
+			sim->enabled = true;
+			break;
+
+		case 0x09:
+			// disable keyboard
+			sim->enabled = false;
+			break;
+
+		case 0x94:
+			// start of an LED frame
+			sim->frame[0] = byte;
+			sim->frame_len = 1;
+			break;
+
+		default:
+			// the LPFK ignores anything it doesn't understand
+			break;
+	}
+}
+
+/**
+ * Put bytes the host sent at time 'now' on the line, and work out when each
+ * finishes arriving. The caller makes sure there's room.
+ */
+static void lpfk_sim_line_in(LPFK_SIM *sim, const unsigned char *buf,
+		const size_t n, const long long now)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (sim->rx_free < now) {
+			sim->rx_free = now;
+		}
+		sim->rx_free += lpfk_sim_char_ns(sim);
+
+		sim->rxq[sim->rxq_head % LPFK_SIM_LINE_SLOTS].byte = buf[i];
+		sim->rxq[sim->rxq_head % LPFK_SIM_LINE_SLOTS].due = sim->rx_free;
+		sim->rxq_head++;
+	}
+}
+
+/**
+ * Read whatever the host has sent, and put it on the line.
+ */
+static void lpfk_sim_rx_pump(LPFK_SIM *sim, const long long now)
+{
+	unsigned char buf[64];
+	unsigned int space;
+	ssize_t n;
+
+	for (;;) {
+		space = LPFK_SIM_LINE_SLOTS - (sim->rxq_head - sim->rxq_tail);
+		if (space == 0) {
+			// leave the rest in the pty until the line catches up
+			return;
+		}
+
+		n = read(sim->master_fd, buf, (space < sizeof(buf)) ? space : sizeof(buf));
+		if (n <= 0) {
+			return;
+		}
+
+		lpfk_sim_line_in(sim, buf, n, now);
+	}
+}
+
+/**
+ * Send the host every byte which has finished crossing the line.
+ */
+static void lpfk_sim_tx_pump(LPFK_SIM *sim, const long long now)
+{
+	unsigned char buf[LPFK_SIM_LINE_SLOTS];
+	unsigned int n = 0;
+	ssize_t w;
+
+	while ((sim->txq_tail + n) != sim->txq_head) {
+		LPFK_SIM_BYTE *b = &sim->txq[(sim->txq_tail + n) % LPFK_SIM_LINE_SLOTS];
+		if (b->due > now) {
+			break;
+		}
+		buf[n++] = b->byte;
+	}
+
+	if (n == 0) {
+		return;
+	}
+
+	w = write(sim->master_fd, buf, n);
+	if (w > 0) {
+		sim->txq_tail += w;
+	}
+}
+
+/**
+ * Act on commands which have finished arriving, and press any keys which
+ * are due.
+ */
+static void lpfk_sim_step(LPFK_SIM *sim, const long long now)
+{
+	// act on commands which have finished arriving
+	while ((sim->rxq_head != sim->rxq_tail) &&
+			(sim->rxq[sim->rxq_tail % LPFK_SIM_LINE_SLOTS].due <= now)) {
+		LPFK_SIM_BYTE *b = &sim->rxq[sim->rxq_tail % LPFK_SIM_LINE_SLOTS];
+		sim->rxq_tail++;
+		lpfk_sim_rx_byte(sim, b->byte, b->due);
+	}
+
+	// press any keys which are due
+	while ((sim->nkeys > 0) && (sim->keys[0].due <= now)) {
+		if (sim->enabled) {
+			lpfk_sim_send(sim, sim->keys[0].key, sim->keys[0].due);
+		}
+		sim->nkeys--;
+		memmove(&sim->keys[0], &sim->keys[1], sim->nkeys * sizeof(sim->keys[0]));
+	}
+}
+
+/**
+ * Time of the next thing the simulator has to do, or -1 if nothing is
+ * scheduled.
+ */
+static long long lpfk_sim_next_due(LPFK_SIM *sim)
+{
+	long long due = -1;
+
+	if (sim->rxq_head != sim->rxq_tail) {
+		due = sim->rxq[sim->rxq_tail % LPFK_SIM_LINE_SLOTS].due;
+	}
+	if ((sim->txq_head != sim->txq_tail) &&
+			((due < 0) || (sim->txq[sim->txq_tail % LPFK_SIM_LINE_SLOTS].due < due))) {
+		due = sim->txq[sim->txq_tail % LPFK_SIM_LINE_SLOTS].due;
+	}
+	if ((sim->nkeys > 0) && ((due < 0) || (sim->keys[0].due < due))) {
+		due = sim->keys[0].due;
+	}
+
+	return due;
+}
+/* }}} */
+
+/* lpfk_sim_default_options {{{ */
+void lpfk_sim_default_options(LPFK_SIM_OPTIONS *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->flags = LPFK_SIM_LINE_TIMING;
+}
+/* }}} */
+
+/* lpfk_sim_open {{{ */
+int lpfk_sim_open(LPFK_SIM *sim, const LPFK_SIM_OPTIONS *opts)
+{
+	pthread_mutexattr_t attr;
+	struct termios tio;
+	int sv[2];
+
+	memset(sim, 0, sizeof(*sim));
+	sim->master_fd = sim->slave_fd = sim->wake_efd = -1;
+
+	if (opts != NULL) {
+		sim->opts = *opts;
+	} else {
+		lpfk_sim_default_options(&sim->opts);
+	}
+
+	if ((sim->opts.latency_us < 0) || (sim->opts.nak_every < 0) ||
+			(sim->opts.ack_drop_every < 0) ||
+			((sim->opts.flags & LPFK_SIM_SOCKETPAIR) &&
+			 (sim->opts.flags & LPFK_SIM_LOOPBACK))) {
+		return LPFK_E_PARAM;
+	}
+
+	if (sim->opts.flags & LPFK_SIM_LOOPBACK) {
+		// no descriptors; lpfk_sim_transport() calls straight in
+	} else if (sim->opts.flags & LPFK_SIM_SOCKETPAIR) {
+		// the host gets a copy of the other end from lpfk_sim_transport()
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+			return LPFK_E_PORT_OPEN;
+		}
+		sim->master_fd = sv[0];
+		sim->slave_fd = sv[1];
+	} else {
+		// create the pty
+		sim->master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (sim->master_fd < 0) {
+			return LPFK_E_PORT_OPEN;
+		}
+
+		if ((grantpt(sim->master_fd) < 0) || (unlockpt(sim->master_fd) < 0) ||
+				(ptsname_r(sim->master_fd, sim->path, sizeof(sim->path)) != 0)) {
+			goto fail;
+		}
+
+		// hold the slave open, so the master doesn't see a hangup every time
+		// the host closes the port; and make it raw until the host sets it up
+		sim->slave_fd = open(sim->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (sim->slave_fd < 0) {
+			goto fail;
+		}
+		if (tcgetattr(sim->slave_fd, &tio) == 0) {
+			cfmakeraw(&tio);
+			tcsetattr(sim->slave_fd, TCSANOW, &tio);
+		}
+	}
+
+	if (sim->master_fd >= 0) {
+		fcntl(sim->master_fd, F_SETFL, fcntl(sim->master_fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	sim->wake_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (sim->wake_efd < 0) {
+		goto fail;
+	}
+
+	// recursive, so the LED callback can call back into the simulator
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sim->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return LPFK_E_OK;
+
+fail:
+	if (sim->slave_fd >= 0) close(sim->slave_fd);
+	if (sim->master_fd >= 0) close(sim->master_fd);
+	return LPFK_E_PORT_OPEN;
+}
+/* }}} */
+
+/* lpfk_sim_close {{{ */
+int lpfk_sim_close(LPFK_SIM *sim)
+{
+	lpfk_sim_stop(sim);
+
+	close(sim->wake_efd);
+	if (sim->slave_fd >= 0) close(sim->slave_fd);
+	if (sim->master_fd >= 0) close(sim->master_fd);
+	pthread_mutex_destroy(&sim->lock);
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_sim_path {{{ */
+const char *lpfk_sim_path(LPFK_SIM *sim)
+{
+	return sim->path;
+}
+/* }}} */
+
+/* Loopback transport {{{ */
+static ssize_t lpfk_sim_lb_write(LPFK_TRANSPORT *t, const void *buf, const size_t len)
+{
+	LPFK_SIM *sim = t->priv;
+	unsigned int space;
+	size_t n;
+
+	pthread_mutex_lock(&sim->lock);
+	space = LPFK_SIM_LINE_SLOTS - (sim->rxq_head - sim->rxq_tail);
+	n = (len < space) ? len : space;
+	lpfk_sim_line_in(sim, buf, n, lpfk_sim_now());
+	// with no line timing, the LPFK acts on it (and answers) straight away
+	lpfk_sim_step(sim, lpfk_sim_now());
+	pthread_mutex_unlock(&sim->lock);
+
+	if (n == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return n;
+}
+
+static ssize_t lpfk_sim_lb_read(LPFK_TRANSPORT *t, void *buf, const size_t len)
+{
+	LPFK_SIM *sim = t->priv;
+	unsigned char *p = buf;
+	long long now = lpfk_sim_now();
+	size_t n = 0;
+
+	pthread_mutex_lock(&sim->lock);
+	lpfk_sim_step(sim, now);
+	while ((n < len) && (sim->txq_head != sim->txq_tail) &&
+			(sim->txq[sim->txq_tail % LPFK_SIM_LINE_SLOTS].due <= now)) {
+		p[n++] = sim->txq[sim->txq_tail % LPFK_SIM_LINE_SLOTS].byte;
+		sim->txq_tail++;
+	}
+	pthread_mutex_unlock(&sim->lock);
+
+	return n;
+}
+
+static int lpfk_sim_lb_rx_timeout(LPFK_TRANSPORT *t)
+{
+	LPFK_SIM *sim = t->priv;
+
+	pthread_mutex_lock(&sim->lock);
+	lpfk_sim_step(sim, lpfk_sim_now());
+	pthread_mutex_unlock(&sim->lock);
+
+	// wakes the host for commands and keypresses as well as bytes to read,
+	// so they get acted on in time
+	return lpfk_sim_get_timeout(sim);
+}
+
+static void lpfk_sim_lb_flush_input(LPFK_TRANSPORT *t)
+{
+	unsigned char buf[64];
+
+	while (lpfk_sim_lb_read(t, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void lpfk_sim_lb_close(LPFK_TRANSPORT *t)
+{
+	// the simulator outlives the connection
+	(void)t;
+}
+
+static const LPFK_TRANSPORT_OPS lpfk_sim_lb_ops = {
+	.write = lpfk_sim_lb_write,
+	.read = lpfk_sim_lb_read,
+	.rx_timeout = lpfk_sim_lb_rx_timeout,
+	.flush_input = lpfk_sim_lb_flush_input,
+	.set_reset = NULL,
+	.low_latency = NULL,
+	.close = lpfk_sim_lb_close
+};
+/* }}} */
+
+/* lpfk_sim_transport {{{ */
+int lpfk_sim_transport(LPFK_SIM *sim, LPFK_TRANSPORT *t)
+{
+	int fd;
+
+	if (sim->opts.flags & LPFK_SIM_LOOPBACK) {
+		memset(t, 0, sizeof(*t));
+		t->ops = &lpfk_sim_lb_ops;
+		t->fd = -1;
+		t->priv = sim;
+		return LPFK_E_OK;
+	} else if (sim->opts.flags & LPFK_SIM_SOCKETPAIR) {
+		fd = fcntl(sim->slave_fd, F_DUPFD_CLOEXEC, 0);
+		if (fd < 0) {
+			return LPFK_E_PORT_OPEN;
+		}
+		return lpfk_transport_fd(t, fd);
+	}
+
+	return lpfk_transport_tty(t, sim->path);
+}
+/* }}} */
+
+/* lpfk_sim_process {{{ */
+int lpfk_sim_process(LPFK_SIM *sim)
+{
+	long long now = lpfk_sim_now();
+	uint64_t count;
+
+	pthread_mutex_lock(&sim->lock);
+
+	if (read(sim->wake_efd, &count, sizeof(count)) < 0) {
+		// nothing to acknowledge
+	}
+
+	// in loopback mode the host does all of this itself
+	if (sim->master_fd >= 0) {
+		lpfk_sim_rx_pump(sim, now);
+		lpfk_sim_step(sim, now);
+		lpfk_sim_tx_pump(sim, now);
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_sim_get_fd {{{ */
+int lpfk_sim_get_fd(LPFK_SIM *sim)
+{
+	return sim->master_fd;
+}
+/* }}} */
+
+/* lpfk_sim_get_timeout {{{ */
+int lpfk_sim_get_timeout(LPFK_SIM *sim)
+{
+	long long due, wait;
+
+	pthread_mutex_lock(&sim->lock);
+	due = lpfk_sim_next_due(sim);
+	pthread_mutex_unlock(&sim->lock);
+
+	if (due < 0) {
+		return -1;
+	}
+
+	wait = due - lpfk_sim_now();
+	if (wait <= 0) {
+		return 0;
+	}
+
+	return (int)((wait + 999999) / 1000000);
+}
+/* }}} */
+
+/* Background thread {{{ */
+static void *lpfk_sim_thread(void *arg)
+{
+	LPFK_SIM *sim = arg;
+	struct pollfd pfd[2];
+	struct timespec ts;
+	long long due, wait;
+
+	while (__atomic_load_n(&sim->running, __ATOMIC_ACQUIRE)) {
+		lpfk_sim_process(sim);
+
+		pthread_mutex_lock(&sim->lock);
+		due = lpfk_sim_next_due(sim);
+		// stop watching the pty if the line is backed up
+		pfd[0].fd = sim->master_fd;
+		pfd[0].events = ((sim->rxq_head - sim->rxq_tail) < LPFK_SIM_LINE_SLOTS) ? POLLIN : 0;
+		pthread_mutex_unlock(&sim->lock);
+
+		pfd[1].fd = sim->wake_efd;
+		pfd[1].events = POLLIN;
+
+		// poll() only does milliseconds, which is coarser than a character
+		if (due >= 0) {
+			wait = due - lpfk_sim_now();
+			if (wait < 0) wait = 0;
+			ts.tv_sec = wait / 1000000000LL;
+			ts.tv_nsec = wait % 1000000000LL;
+		}
+
+		ppoll(pfd, 2, (due >= 0) ? &ts : NULL, NULL);
+	}
+
+	return NULL;
+}
+
+int lpfk_sim_start(LPFK_SIM *sim)
+{
+	// a loopback simulator runs on the host's thread
+	if (sim->running || (sim->opts.flags & LPFK_SIM_LOOPBACK)) {
+		return LPFK_E_OK;
+	}
+
+	__atomic_store_n(&sim->running, true, __ATOMIC_RELEASE);
+	if (pthread_create(&sim->thread, NULL, lpfk_sim_thread, sim) != 0) {
+		sim->running = false;
+		return LPFK_E_COMMS;
+	}
+
+	return LPFK_E_OK;
+}
+
+int lpfk_sim_stop(LPFK_SIM *sim)
+{
+	if (!sim->running) {
+		return LPFK_E_OK;
+	}
+
+	__atomic_store_n(&sim->running, false, __ATOMIC_RELEASE);
+	lpfk_sim_wake(sim);
+	pthread_join(sim->thread, NULL);
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* Keypress injection {{{ */
+/**
+ * Add a keypress to the schedule, which is kept in time order.
+ */
+static int lpfk_sim_schedule(LPFK_SIM *sim, const int key, const long long due)
+{
+	int i;
+
+	if (sim->nkeys >= LPFK_SIM_MAX_KEYS) {
+		return LPFK_E_BUSY;
+	}
+
+	for (i=sim->nkeys; (i > 0) && (sim->keys[i-1].due > due); i--) {
+		sim->keys[i] = sim->keys[i-1];
+	}
+	sim->keys[i].key = key;
+	sim->keys[i].due = due;
+	sim->nkeys++;
+
+	return LPFK_E_OK;
+}
+
+int lpfk_sim_press(LPFK_SIM *sim, const int key, const int delay_ms)
+{
+	int err;
+
+	if ((key < 0) || (key > 31) || (delay_ms < 0)) {
+		return LPFK_E_PARAM;
+	}
+
+	pthread_mutex_lock(&sim->lock);
+	err = lpfk_sim_schedule(sim, key, lpfk_sim_now() + (delay_ms * 1000000LL));
+	pthread_mutex_unlock(&sim->lock);
+
+	lpfk_sim_wake(sim);
+	return err;
+}
+
+int lpfk_sim_script(LPFK_SIM *sim, const char *script)
+{
+	LPFK_SIM_KEY parsed[LPFK_SIM_MAX_KEYS];
+	const char *p = script;
+	char *end;
+	long long t;
+	long key, delay;
+	int i, n = 0, err = LPFK_E_OK;
+
+	// parse the whole script first, so a bad one schedules nothing
+	while (*p != '\0') {
+		if ((*p == ' ') || (*p == ',') || (*p == '\t') || (*p == '\n')) {
+			p++;
+			continue;
+		}
+
+		key = strtol(p, &end, 10);
+		if ((end == p) || (key < 0) || (key > 31)) {
+			return LPFK_E_PARAM;
+		}
+		p = end;
+
+		delay = 0;
+		if (*p == '@') {
+			p++;
+			delay = strtol(p, &end, 10);
+			if ((end == p) || (delay < 0)) {
+				return LPFK_E_PARAM;
+			}
+			p = end;
+		}
+
+		if (n >= LPFK_SIM_MAX_KEYS) {
+			return LPFK_E_BUSY;
+		}
+		parsed[n].key = key;
+		parsed[n].due = delay * 1000000LL;
+		n++;
+	}
+
+	pthread_mutex_lock(&sim->lock);
+
+	if ((sim->nkeys + n) > LPFK_SIM_MAX_KEYS) {
+		err = LPFK_E_BUSY;
+	} else {
+		// the script carries on from the last one, if that's still running
+		t = lpfk_sim_now();
+		if (sim->script_time > t) {
+			t = sim->script_time;
+		}
+		for (i=0; i<n; i++) {
+			t += parsed[i].due;
+			lpfk_sim_schedule(sim, parsed[i].key, t);
+		}
+		sim->script_time = t;
+	}
+
+	pthread_mutex_unlock(&sim->lock);
+
+	lpfk_sim_wake(sim);
+	return err;
+}
+/* }}} */
+
+/* State queries {{{ */
+unsigned long lpfk_sim_get_leds(LPFK_SIM *sim)
+{
+	unsigned long mask;
+
+	pthread_mutex_lock(&sim->lock);
+	mask = sim->led_mask;
+	pthread_mutex_unlock(&sim->lock);
+
+	return mask;
+}
+
+int lpfk_sim_get_enabled(LPFK_SIM *sim)
+{
+	int enabled;
+
+	pthread_mutex_lock(&sim->lock);
+	enabled = sim->enabled;
+	pthread_mutex_unlock(&sim->lock);
+
+	return enabled;
+}
+
+void lpfk_sim_set_led_cb(LPFK_SIM *sim, LPFK_SIM_LED_CB cb, void *user)
+{
+	pthread_mutex_lock(&sim->lock);
+	sim->led_cb = cb;
+	sim->led_user = user;
+	pthread_mutex_unlock(&sim->lock);
+}
+/* }}} */
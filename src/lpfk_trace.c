@@ -0,0 +1,209 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_trace.c
+ * @brief	liblpfk serial traffic trace
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "liblpfk.h"
+#include "lpfk_trace.h"
+
+/**
+ * Map a trace file.
+ */
+static int lpfk_trace_map(LPFK_TRACE *trace, const int fd, const size_t size,
+		const int prot)
+{
+	void *p = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED) {
+		return LPFK_E_PORT_OPEN;
+	}
+
+	trace->hdr = p;
+	trace->rec = (LPFK_TRACE_REC *)(trace->hdr + 1);
+	trace->size = size;
+	return LPFK_E_OK;
+}
+
+/* lpfk_trace_create {{{ */
+int lpfk_trace_create(LPFK_TRACE *trace, const char *path, const int nrecords)
+{
+	struct timespec ts;
+	size_t size;
+	int n = (nrecords == 0) ? LPFK_TRACE_DEFAULT_RECORDS : nrecords;
+	int fd;
+
+	if ((path == NULL) || (n < 1)) {
+		return LPFK_E_PARAM;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return LPFK_E_PORT_OPEN;
+	}
+
+	// the file is sized up front, so recording never has to extend it
+	size = sizeof(LPFK_TRACE_HDR) + ((size_t)n * sizeof(LPFK_TRACE_REC));
+	if ((ftruncate(fd, size) < 0) ||
+			(lpfk_trace_map(trace, fd, size, PROT_READ | PROT_WRITE) != LPFK_E_OK)) {
+		close(fd);
+		unlink(path);
+		return LPFK_E_PORT_OPEN;
+	}
+	close(fd);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	memcpy(trace->hdr->magic, LPFK_TRACE_MAGIC, sizeof(trace->hdr->magic));
+	trace->hdr->rec_size = sizeof(LPFK_TRACE_REC);
+	trace->hdr->nrecords = n;
+	trace->hdr->start_ns = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_trace_load {{{ */
+int lpfk_trace_load(LPFK_TRACE *trace, const char *path)
+{
+	struct stat st;
+	LPFK_TRACE_HDR *hdr;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return LPFK_E_PORT_OPEN;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(LPFK_TRACE_HDR))) {
+		close(fd);
+		return LPFK_E_PARAM;
+	}
+
+	if (lpfk_trace_map(trace, fd, st.st_size, PROT_READ) != LPFK_E_OK) {
+		close(fd);
+		return LPFK_E_PORT_OPEN;
+	}
+	close(fd);
+
+	// make sure it's ours, and that the ring fits in the file
+	hdr = trace->hdr;
+	if ((memcmp(hdr->magic, LPFK_TRACE_MAGIC, sizeof(hdr->magic)) != 0) ||
+			(hdr->rec_size != sizeof(LPFK_TRACE_REC)) || (hdr->nrecords < 1) ||
+			(trace->size < sizeof(LPFK_TRACE_HDR) +
+				((size_t)hdr->nrecords * sizeof(LPFK_TRACE_REC)))) {
+		lpfk_trace_close(trace);
+		return LPFK_E_PARAM;
+	}
+
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_trace_close {{{ */
+int lpfk_trace_close(LPFK_TRACE *trace)
+{
+	munmap(trace->hdr, trace->size);
+	return LPFK_E_OK;
+}
+/* }}} */
+
+/* lpfk_trace_record {{{ */
+void lpfk_trace_record(LPFK_TRACE *trace, const int dir, const long long ts_ns,
+		const void *buf, const size_t len)
+{
+	const uint8_t *p = buf;
+	LPFK_TRACE_REC *rec;
+	uint64_t slot;
+	size_t n, done;
+
+	for (done=0; done<len; done+=n) {
+		n = len - done;
+		if (n > LPFK_TRACE_DATA) {
+			n = LPFK_TRACE_DATA;
+		}
+
+		// claim a slot; the I/O thread and the application may both be
+		// recording
+		slot = __atomic_fetch_add(&trace->hdr->count, 1, __ATOMIC_RELAXED);
+		rec = &trace->rec[slot % trace->hdr->nrecords];
+		rec->ts_ns = ts_ns;
+		rec->dir = dir;
+		rec->len = n;
+		rec->reserved = 0;
+		memcpy(rec->data, p + done, n);
+	}
+}
+/* }}} */
+
+/* lpfk_trace_count {{{ */
+unsigned long lpfk_trace_count(LPFK_TRACE *trace)
+{
+	uint64_t count = trace->hdr->count;
+
+	return (count < trace->hdr->nrecords) ? count : trace->hdr->nrecords;
+}
+/* }}} */
+
+/* lpfk_trace_lost {{{ */
+unsigned long long lpfk_trace_lost(LPFK_TRACE *trace)
+{
+	return trace->hdr->count - lpfk_trace_count(trace);
+}
+/* }}} */
+
+/* lpfk_trace_get {{{ */
+const LPFK_TRACE_REC *lpfk_trace_get(LPFK_TRACE *trace, const unsigned long n)
+{
+	if (n >= lpfk_trace_count(trace)) {
+		return NULL;
+	}
+
+	// the oldest record is the one after the newest
+	return &trace->rec[(lpfk_trace_lost(trace) + n) % trace->hdr->nrecords];
+}
+/* }}} */
@@ -0,0 +1,286 @@
+/****************************************************************************
+ * Project:		liblpfk
+ * Purpose:		Driver library for the IBM 6094-020 Lighted Program Function
+ * 				Keyboard.
+ * Version:		1.0
+ * Author:		Philip Pemberton <philpem@philpem.me.uk>
+ *
+ * The latest version of this library is available from
+ * <http://www.philpem.me.uk/code/liblpfk/>.
+ *
+ * Copyright (c) 2008, Philip Pemberton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of the project nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+
+/**
+ * @file	lpfk_transport.c
+ * @brief	liblpfk serial port and descriptor transports
+ */
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/serial.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "liblpfk.h"
+
+/* Descriptor transport {{{ */
+static ssize_t lpfk_fd_write(LPFK_TRANSPORT *t, const void *buf, const size_t len)
+{
+	return write(t->fd, buf, len);
+}
+
+static ssize_t lpfk_fd_read(LPFK_TRANSPORT *t, void *buf, const size_t len)
+{
+	return read(t->fd, buf, len);
+}
+
+static void lpfk_fd_flush_input(LPFK_TRANSPORT *t)
+{
+	unsigned char buf[64];
+
+	while (read(t->fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void lpfk_fd_close(LPFK_TRANSPORT *t)
+{
+	close(t->fd);
+}
+
+static const LPFK_TRANSPORT_OPS lpfk_fd_ops = {
+	.write = lpfk_fd_write,
+	.read = lpfk_fd_read,
+	.rx_timeout = NULL,
+	.flush_input = lpfk_fd_flush_input,
+	.set_reset = NULL,
+	.low_latency = NULL,
+	.close = lpfk_fd_close
+};
+
+/* lpfk_transport_fd {{{ */
+int lpfk_transport_fd(LPFK_TRANSPORT *t, const int fd)
+{
+	int flags;
+
+	if ((fd < 0) || ((flags = fcntl(fd, F_GETFL)) < 0)) {
+		return LPFK_E_PARAM;
+	}
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	memset(t, 0, sizeof(*t));
+	t->ops = &lpfk_fd_ops;
+	t->fd = fd;
+	return LPFK_E_OK;
+}
+/* }}} */
+/* }}} */
+
+/* Serial port transport {{{ */
+static void lpfk_tty_flush_input(LPFK_TRANSPORT *t)
+{
+	tcflush(t->fd, TCIFLUSH);
+}
+
+static void lpfk_tty_set_reset(LPFK_TRANSPORT *t, const int reset)
+{
+	int status;
+
+	// RTS is the LPFK's reset line, active low
+	ioctl(t->fd, TIOCMGET, &status);
+	if (reset) {
+		status &= ~TIOCM_RTS;
+	} else {
+		status |= TIOCM_RTS;
+	}
+	ioctl(t->fd, TIOCMSET, &status);
+}
+
+/**
+ * Find the latency_timer attribute of the USB serial adapter behind a port.
+ * ftdi_sio has one; most other drivers don't.
+ */
+static void lpfk_tty_latency_path(LPFK_TRANSPORT *t, char *path, const size_t len)
+{
+	struct stat st;
+
+	path[0] = '\0';
+	if ((fstat(t->fd, &st) == 0) && S_ISCHR(st.st_mode)) {
+		snprintf(path, len, "/sys/dev/char/%u:%u/device/latency_timer",
+				major(st.st_rdev), minor(st.st_rdev));
+	}
+}
+
+static int lpfk_tty_read_latency(const char *path)
+{
+	char buf[16];
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	buf[n] = '\0';
+	return atoi(buf);
+}
+
+static int lpfk_tty_write_latency(const char *path, const int ms)
+{
+	char buf[16];
+	int fd, n, ok;
+
+	if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+		return false;
+	}
+	n = snprintf(buf, sizeof(buf), "%d\n", ms);
+	ok = (write(fd, buf, n) == n);
+	close(fd);
+	return ok;
+}
+
+static int lpfk_tty_low_latency(LPFK_TRANSPORT *t)
+{
+	struct serial_struct ss;
+	char path[LPFK_PATH_MAX];
+	int old;
+
+	// ASYNC_LOW_LATENCY: the driver pushes received bytes to the tty layer
+	// as they arrive. Read it back; some drivers take the ioctl and ignore
+	// the flag.
+	if (ioctl(t->fd, TIOCGSERIAL, &ss) == 0) {
+		if (!(ss.flags & ASYNC_LOW_LATENCY)) {
+			old = ss.flags;
+			ss.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(t->fd, TIOCSSERIAL, &ss) == 0) {
+				t->old_serial_flags = old;
+			}
+		}
+		if ((ioctl(t->fd, TIOCGSERIAL, &ss) == 0) && (ss.flags & ASYNC_LOW_LATENCY)) {
+			t->lowlat |= LPFK_LOWLAT_SERIAL;
+		}
+	}
+
+	// ftdi_sio holds received bytes for up to latency_timer ms, unless its
+	// buffer fills first; at 9600 baud it never does
+	lpfk_tty_latency_path(t, path, sizeof(path));
+	old = lpfk_tty_read_latency(path);
+	if ((old > 1) && lpfk_tty_write_latency(path, 1)) {
+		t->old_latency_ms = old;
+	}
+	if ((old >= 0) && (lpfk_tty_read_latency(path) <= 1)) {
+		t->lowlat |= LPFK_LOWLAT_TIMER;
+	}
+
+	return t->lowlat;
+}
+
+static void lpfk_tty_close(LPFK_TRANSPORT *t)
+{
+	struct serial_struct ss;
+	char path[LPFK_PATH_MAX];
+
+	// put back the low latency settings we changed
+	if ((t->old_serial_flags >= 0) && (ioctl(t->fd, TIOCGSERIAL, &ss) == 0)) {
+		ss.flags = (ss.flags & ~ASYNC_LOW_LATENCY) |
+			(t->old_serial_flags & ASYNC_LOW_LATENCY);
+		ioctl(t->fd, TIOCSSERIAL, &ss);
+	}
+	if (t->old_latency_ms >= 0) {
+		lpfk_tty_latency_path(t, path, sizeof(path));
+		lpfk_tty_write_latency(path, t->old_latency_ms);
+	}
+
+	// Restore the port state and close the serial port.
+	tcsetattr(t->fd, TCSANOW, &t->oldtio);
+	close(t->fd);
+}
+
+static const LPFK_TRANSPORT_OPS lpfk_tty_ops = {
+	.write = lpfk_fd_write,
+	.read = lpfk_fd_read,
+	.rx_timeout = NULL,
+	.flush_input = lpfk_tty_flush_input,
+	.set_reset = lpfk_tty_set_reset,
+	.low_latency = lpfk_tty_low_latency,
+	.close = lpfk_tty_close
+};
+
+/* lpfk_transport_tty {{{ */
+int lpfk_transport_tty(LPFK_TRANSPORT *t, const char *port)
+{
+	struct termios newtio;
+
+	memset(t, 0, sizeof(*t));
+	t->ops = &lpfk_tty_ops;
+	t->old_serial_flags = t->old_latency_ms = -1;
+
+	// open the serial port
+	t->fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);
+	if (t->fd < 0) return LPFK_E_PORT_OPEN;
+
+	// save current port settings
+	tcgetattr(t->fd, &t->oldtio);
+
+	// set up new parameters
+	memset(&newtio, 0, sizeof(newtio));
+	// 9600 baud, 8 bits, parity enabled, odd parity
+	newtio.c_cflag = B9600 | CS8 | PARENB | PARODD | CLOCAL | CREAD;
+	newtio.c_iflag = 0;
+	newtio.c_oflag = 0;
+
+	// set input mode -- non canonical, no echo
+	newtio.c_lflag = 0;
+
+	// inter-character timer unused
+	newtio.c_cc[VTIME] = 0;
+	// read does not block waiting for characters if there are none in the buffer
+	newtio.c_cc[VMIN]  = 0;
+
+	// flush input buffer
+	tcflush(t->fd, TCIFLUSH);
+
+	// set new port config
+	tcsetattr(t->fd, TCSANOW, &newtio);
+
+	return LPFK_E_OK;
+}
+/* }}} */
+/* }}} */
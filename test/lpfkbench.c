@@ -0,0 +1,308 @@
+// lpfkbench: measure liblpfk's LED update and keypress latencies
+//
+// Runs against a real LPFK, or with -s against the simulator: on a pty, a
+// socketpair, or in-process with no kernel in the way (-m). Results are
+// printed as a single JSON object, so builds can be compared by script.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include "liblpfk.h"
+#include "lpfk_sim.h"
+#include "lpfk_dither.h"
+
+/// when the simulator last saw an LED frame (ns)
+static long long sim_led_time;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// print the distribution of n samples (in ms) as a JSON object
+static void print_dist(const char *name, double *samples, int n, bool last)
+{
+	qsort(samples, n, sizeof(double), cmp_double);
+
+	if (n == 0) {
+		printf("  \"%s\": null%s\n", name, last ? "" : ",");
+		return;
+	}
+
+	printf("  \"%s\": {\"n\": %d, \"min\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+			name, n, samples[0], samples[n / 2], samples[(n * 99) / 100],
+			samples[n - 1], last ? "" : ",");
+}
+
+static void sim_led_changed(LPFK_SIM *sim, const unsigned long mask, void *user)
+{
+	(void)sim;
+	(void)mask;
+	(void)user;
+	__atomic_store_n(&sim_led_time, now_ns(), __ATOMIC_RELEASE);
+}
+
+// connect to the LPFK, or to the simulator over its own transport
+static int open_lpfk(LPFK_CTX *ctx, const char *port, LPFK_SIM *sim,
+		const LPFK_OPTIONS *opts)
+{
+	LPFK_TRANSPORT t;
+
+	if (sim == NULL) {
+		return lpfk_open_ex(ctx, port, opts);
+	}
+
+	if (lpfk_sim_transport(sim, &t) != LPFK_E_OK) {
+		return LPFK_E_PORT_OPEN;
+	}
+	return lpfk_open_transport(ctx, &t, opts);
+}
+
+static void usage(const char *prog)
+{
+	printf("Syntax: %s [options] {commport | -s}\n", prog);
+	printf("  -s        use the simulator instead of a real LPFK\n");
+	printf("  -m mode   simulator transport: pty, socket or loop (default pty)\n");
+	printf("  -f        simulator: don't model the 9600 baud line\n");
+	printf("  -l        ask the serial port for low latency\n");
+	printf("  -o count  number of times to open the port (default 5)\n");
+	printf("  -n count  number of LED updates to time (default 200)\n");
+	printf("  -t secs   time to run the frame rate test for (default 2)\n");
+	printf("  -k count  number of keypresses to time (default 100 with -s, 0 otherwise)\n");
+}
+
+int main(int argc, char **argv)
+{
+	LPFK_CTX ctx;
+	LPFK_OPTIONS opts;
+	LPFK_SIM sim;
+	LPFK_SIM_OPTIONS simopts;
+	LPFK_KEY_EVENT ev;
+	LPFK_STATS stats;
+	LPFK_DITHER dither;
+	struct pollfd pfd;
+	const char *port = NULL;
+	const char *mode = "pty";
+	bool use_sim = false;
+	int opens = 5, updates = 200, secs = 2, keys = -1;
+	double *samples;
+	long long t, start;
+	unsigned long frames;
+	int i, n, tmo, lost, err, opt;
+
+	lpfk_default_options(&opts);
+	lpfk_sim_default_options(&simopts);
+
+	while ((opt = getopt(argc, argv, "sm:flo:n:t:k:")) != -1) {
+		switch (opt) {
+			case 's': use_sim = true; break;
+			case 'm': use_sim = true; mode = optarg; break;
+			case 'f': simopts.flags &= ~LPFK_SIM_LINE_TIMING; break;
+			case 'l': opts.flags |= LPFK_OPT_LOW_LATENCY; break;
+			case 'o': opens = atoi(optarg); break;
+			case 'n': updates = atoi(optarg); break;
+			case 't': secs = atoi(optarg); break;
+			case 'k': keys = atoi(optarg); break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+
+	if (use_sim) {
+		if (strcmp(mode, "socket") == 0) {
+			simopts.flags |= LPFK_SIM_SOCKETPAIR;
+		} else if (strcmp(mode, "loop") == 0) {
+			simopts.flags |= LPFK_SIM_LOOPBACK;
+		} else if (strcmp(mode, "pty") != 0) {
+			usage(argv[0]);
+			return -1;
+		}
+		if (lpfk_sim_open(&sim, &simopts) != LPFK_E_OK) {
+			fprintf(stderr, "Error creating simulator.\n");
+			return -2;
+		}
+		lpfk_sim_set_led_cb(&sim, sim_led_changed, NULL);
+		lpfk_sim_start(&sim);
+		port = lpfk_sim_path(&sim);
+		if (keys < 0) keys = 100;
+	} else if (optind < argc) {
+		port = argv[optind];
+		if (keys < 0) keys = 0;
+	} else {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if ((opens < 1) || (updates < 1) || (secs < 1)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	n = opens;
+	if (updates > n) n = updates;
+	if (keys > n) n = keys;
+	samples = malloc(n * sizeof(double));
+
+	printf("{\n");
+	printf("  \"target\": \"%s\",\n", use_sim ? "sim" : port);
+	if (use_sim) {
+		printf("  \"transport\": \"%s\",\n", mode);
+	}
+	printf("  \"line_timing\": %s,\n",
+			(!use_sim || (simopts.flags & LPFK_SIM_LINE_TIMING)) ? "true" : "false");
+
+	// time to open the port and find the LPFK
+	for (i=0; i<opens; i++) {
+		t = now_ns();
+		if ((err = open_lpfk(&ctx, port, use_sim ? &sim : NULL, &opts)) != LPFK_E_OK) {
+			fprintf(stderr, "lpfk_open failed: %d\n", err);
+			return -2;
+		}
+		samples[i] = (now_ns() - t) / 1e6;
+		if (i < (opens - 1)) {
+			lpfk_close(&ctx);
+		}
+	}
+	print_dist("open_ms", samples, opens, false);
+	if (opts.flags & LPFK_OPT_LOW_LATENCY) {
+		printf("  \"low_latency\": {\"serial\": %s, \"latency_timer\": %s},\n",
+				(lpfk_get_low_latency(&ctx) & LPFK_LOWLAT_SERIAL) ? "true" : "false",
+				(lpfk_get_low_latency(&ctx) & LPFK_LOWLAT_TIMER) ? "true" : "false");
+	}
+
+	// LED update latency; alternate the masks so none are suppressed
+	for (i=0; i<updates; i++) {
+		lpfk_set_mask(&ctx, (i & 1) ? 0x55555555UL : 0xAAAAAAAAUL);
+		t = now_ns();
+		if ((err = lpfk_update_leds(&ctx)) != LPFK_E_OK) {
+			fprintf(stderr, "lpfk_update_leds failed: %d\n", err);
+		}
+		samples[i] = (now_ns() - t) / 1e6;
+	}
+	print_dist("update_ms", samples, updates, false);
+
+	// sustained frame rate, sending new frames back to back
+	frames = 0;
+	start = now_ns();
+	do {
+		lpfk_set_mask(&ctx, frames);
+		if (lpfk_update_leds(&ctx) == LPFK_E_OK) {
+			frames++;
+		}
+	} while ((now_ns() - start) < (secs * 1000000000LL));
+	printf("  \"frame_rate_hz\": %.1f,\n", frames / ((now_ns() - start) / 1e9));
+
+	// the same, but driven by the ACK callbacks with no round trip through
+	// the application in between
+	lpfk_dither_init(&dither, &ctx);
+	for (i=0; i<32; i++) {
+		lpfk_dither_set_level(&dither, i, (i * LPFK_DITHER_MAX) / 31);
+	}
+	pfd.fd = lpfk_get_fd(&ctx);
+	pfd.events = POLLIN;
+	start = now_ns();
+	lpfk_dither_start(&dither);
+	while (dither.running && ((now_ns() - start) < (secs * 1000000000LL))) {
+		poll(&pfd, 1, lpfk_get_timeout(&ctx));
+		lpfk_process(&ctx);
+	}
+	lpfk_dither_stop(&dither);
+	printf("  \"dither_rate_hz\": %.1f,\n", dither.frames / ((now_ns() - start) / 1e9));
+
+	// keypress to LED latency, using the toggle loop from lpfktest
+	lpfk_set_mask(&ctx, 0);
+	lpfk_update_leds(&ctx);
+	lpfk_enable(&ctx, true);
+	while (use_sim && !lpfk_sim_get_enabled(&sim)) {
+		// the enable command is still on its way down the line
+		usleep(1000);
+		lpfk_process(&ctx);
+	}
+	if (!use_sim && (keys > 0)) {
+		fprintf(stderr, "Press keys on the LPFK (%d to go)...\n", keys);
+	}
+
+	pfd.fd = lpfk_get_fd(&ctx);
+	pfd.events = POLLIN;
+	ev.key = -1;
+	for (i=0; i<keys; ) {
+		if (use_sim) {
+			t = now_ns();
+			lpfk_sim_press(&sim, i % 32, 0);
+		}
+
+		// wait for the key; give up if a simulated one got lost
+		while (lpfk_read_batch(&ctx, &ev, 1) == 0) {
+			tmo = lpfk_get_timeout(&ctx);
+			if (use_sim && ((tmo < 0) || (tmo > 100))) {
+				tmo = 100;
+			}
+			if ((poll(&pfd, 1, tmo) == 0) && use_sim &&
+					((now_ns() - t) > 1000000000LL)) {
+				break;
+			}
+		}
+
+		if (ev.key < 0) {
+			continue;
+		}
+
+		lpfk_set_led(&ctx, ev.key, !lpfk_get_led(&ctx, ev.key));
+
+		if (use_sim) {
+			// from the key leaving the LPFK to the LED frame arriving
+			samples[i++] = (__atomic_load_n(&sim_led_time, __ATOMIC_ACQUIRE) - t) / 1e6;
+		} else {
+			// from the key arriving to the LED frame being acknowledged
+			samples[i++] = (now_ns() - ((ev.time.tv_sec * 1000000000LL) + ev.time.tv_nsec)) / 1e6;
+		}
+		ev.key = -1;
+	}
+	print_dist(use_sim ? "key_to_led_ms" : "key_to_ack_ms", samples, keys, false);
+
+	// keypress latency through lpfk_wait_key(), which has to wake for the
+	// key itself; with -m loop there is no descriptor to wake it, only the
+	// simulator's timeout through lpfk_get_timeout()
+	if (use_sim) {
+		lost = 0;
+		for (i=0; i<keys; i++) {
+			t = now_ns();
+			lpfk_sim_press(&sim, i % 32, 0);
+			if (lpfk_wait_key(&ctx, 1000) != (i % 32)) {
+				lost++;
+			}
+			samples[i] = (now_ns() - t) / 1e6;
+		}
+		print_dist("wait_key_ms", samples, keys, false);
+		printf("  \"wait_key_lost\": %d,\n", lost);
+	}
+
+	// what the library saw on the line during all that
+	lpfk_get_stats(&ctx, &stats);
+	printf("  \"stats\": {\"bytes_tx\": %llu, \"bytes_rx\": %llu, \"frames_tx\": %llu, "
+			"\"retransmits\": %llu, \"ack_timeouts\": %llu, \"update_failures\": %llu, "
+			"\"keys_dropped\": %llu}\n",
+			stats.bytes_tx, stats.bytes_rx, stats.frames_tx, stats.retransmits,
+			stats.ack_timeouts, stats.update_failures, stats.keys_dropped);
+	printf("}\n");
+
+	lpfk_close(&ctx);
+	if (use_sim) {
+		lpfk_sim_close(&sim);
+	}
+	free(samples);
+
+	return 0;
+}
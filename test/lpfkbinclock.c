@@ -18,16 +18,16 @@
 #include <stdbool.h>
 #include <time.h>
 #include "liblpfk.h"
+#include "lpfk_anim.h"
 
 //#define TEST
 
-int main(int argc, char **argv) 
+/* Work out which LEDs to light for a given time */
+static int clock_frame(LPFK_ANIM *anim, const unsigned long long frame,
+		unsigned long *mask, void *user)
 {
-	LPFK_CTX	ctx;
-	int		i;
-
 	/* Bits for masking off digits of time */
-	int bcdmask[] = { 0x01, 0x02, 0x04, 0x08 };
+	static const int bcdmask[] = { 0x01, 0x02, 0x04, 0x08 };
 
 	// strftime stuff
         static const char *timeFormat = "%H%M%S";
@@ -38,16 +38,67 @@ int main(int argc, char **argv)
 	/* vars for converting ASCII time to individual bits */
 	int timedigit, timebit;
 	int maploc;
+	unsigned long ledmask;
+
+	(void)anim;
+	(void)user;
+
+	/* frames are one second long, so the frame number is the time */
+	thetime = frame;
+	rtime = localtime(&thetime);
+
+	/* reformat time from raw time to BCD HHMMSS to make it easy to parse next */
+        if (strftime(timestr, sizeof(timestr), timeFormat, rtime) == 0)
+       		*timestr = '\0';
+
+#ifdef TEST
+	printf("The time is '%s'\n", timestr);
+#endif /* TEST */
+
+	/* start with seconds and work backwards */
+	ledmask = 0;
+	for (timedigit = 5; timedigit > -1; timedigit--) {
+		/* count bits from 0001 to 1000 forwards */
+		for (timebit = 0; timebit < 4; timebit++) {
+			// ugly!
+			maploc = 5 + 6 * (3 - timebit) + timedigit - 1;
+			if (timestr[timedigit] & bcdmask[timebit])
+				ledmask |= LPFK_LED(maploc);
+
+#ifdef TEST
+			printf("Turning LED %d to %d\n", maploc, timestr[timedigit] & bcdmask[timebit]);
+#endif /* TEST */
+		}
+	}
+
+	*mask = ledmask;
+	return true;
+}
+
+int main(int argc, char **argv) 
+{
+	LPFK_CTX	ctx;
+	LPFK_ANIM	anim;
+	LPFK_PORT_INFO	found;
+	const char	*port;
+	int		i;
+#ifdef TEST
+	unsigned long ledmask;
+#endif /* TEST */
 
-	/* Import our serial port name */
-	if (argc < 2) {
+	/* Import our serial port name, or go and look for an LPFK */
+	if (argc >= 2) {
+		port = argv[1];
+	} else if (lpfk_discover(NULL, &found, 1, NULL) == 1) {
+		port = found.path;
+	} else {
 		printf("Syntax: %s commport\n", argv[0]);
 		return -1;
 	}
 
 	/* Open the LPFK library and retain the handle in ctx */
 #ifndef TEST
-	if ((i = lpfk_open(&ctx, argv[1])) != LPFK_E_OK) {
+	if ((i = lpfk_open(&ctx, port)) != LPFK_E_OK) {
 		switch(i) {
 			case LPFK_E_PORT_OPEN:
 				printf("Error opening comm port.\n");
@@ -69,46 +120,24 @@ int main(int argc, char **argv)
 #endif /* TEST */
 
 	//
-	// loop forever while collecting, reformatting and sending the time
+	// show the time on every second boundary, forever
 	//
-	while(1) {
-
-		/* get time */
-		time(&thetime);
-		rtime = localtime(&thetime);
-
-		/* reformat time from raw time to BCD HHMMSS to make it easy to parse next */
-	        if (strftime(timestr, sizeof(timestr), timeFormat, rtime) == 0)
-        		*timestr = '\0';
-
-#ifdef TEST
-		printf("The time is '%s'\n", timestr);
-#endif /* TEST */
-
-		/* start with seconds and work backwards */
-		for (timedigit = 5; timedigit > -1; timedigit--) {
-			/* count bits from 0001 to 1000 forwards */
-			for (timebit = 0; timebit < 4; timebit++) {
-				// ugly!
-				maploc = 5 + 6 * (3 - timebit) + timedigit - 1;
-#ifndef TEST
-				lpfk_set_led_cached(&ctx, maploc, timestr[timedigit] & bcdmask[timebit]);
-#endif /* TEST */
-
-#ifdef TEST
-				printf("Turning LED %d to %d\n", maploc, timestr[timedigit] & bcdmask[timebit]);
-#endif /* TEST */
-			}
-		}
-
-		/* Update all the LEDs at once */
 #ifndef TEST
-		lpfk_update_leds(&ctx);
-#endif /* TEST */
+	if ((lpfk_anim_init(&anim, &ctx, 1000) != LPFK_E_OK) ||
+			(lpfk_anim_set_generator(&anim, clock_frame, NULL) != LPFK_E_OK) ||
+			(lpfk_anim_start(&anim) != LPFK_E_OK)) {
+		printf("Error starting the clock.\n");
+		lpfk_close(&ctx);
+		return -2;
+	}
 
-		/*  no need to do this hundreds of times per second */
-		sleep(1);  // make it 1 sec for now; screw with nanosleep() later
+	lpfk_anim_run(&anim);
+#else
+	while(1) {
+		clock_frame(NULL, time(NULL), &ledmask, NULL);
+		sleep(1);
 	}
+#endif /* TEST */
 
 }
 
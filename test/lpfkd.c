@@ -0,0 +1,330 @@
+// lpfkd: share one LPFK between many processes
+//
+// Owns the LPFK's serial port and serves clients on a Unix domain socket
+// (see lpfk_client.h for the protocol). Each client gets a compositor layer
+// for its LEDs and a copy of the keypresses it subscribes to. The layers are
+// composited and sent once per frame period, so however many clients change
+// their LEDs, the LPFK gets at most one LED frame per tick.
+
+#define _GNU_SOURCE		// for accept4()
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include "liblpfk.h"
+#include "lpfk_anim.h"
+#include "lpfk_compose.h"
+#include "lpfk_client.h"
+#include "lpfk_sim.h"
+
+// one layer per client
+#define MAX_CLIENTS	LPFK_COMPOSE_MAX_LAYERS
+
+typedef struct {
+	int				fd;			// client socket, -1 if slot free
+	int				layer;		// client's compositor layer
+	unsigned long	keys;		// keys the client has subscribed to
+} CLIENT;
+
+static volatile sig_atomic_t quit = false;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	quit = true;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// clear out a socket left behind by an lpfkd which didn't exit cleanly
+	unlink(path);
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+			(listen(fd, 8) < 0)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void drop_client(LPFK_COMPOSITOR *comp, CLIENT *cl)
+{
+	lpfk_compose_remove_layer(comp, cl->layer);
+	close(cl->fd);
+	cl->fd = -1;
+}
+
+static void accept_clients(int lfd, LPFK_COMPOSITOR *comp, CLIENT *clients)
+{
+	int fd, i;
+
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i=0; (i < MAX_CLIENTS) && (clients[i].fd >= 0); i++)
+			;
+		if (i == MAX_CLIENTS) {
+			// full; hanging up tells the client
+			close(fd);
+			continue;
+		}
+
+		// all clients have the same priority, so the oldest one wins
+		clients[i].layer = lpfk_compose_add_layer(comp, 0);
+		if (clients[i].layer < 0) {
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+		clients[i].keys = 0;
+	}
+}
+
+static void serve_client(LPFK_COMPOSITOR *comp, CLIENT *cl)
+{
+	LPFKD_MSG msg;
+	ssize_t n;
+
+	// take everything the client has sent; the compositor only looks at
+	// the result once per frame
+	while ((n = recv(cl->fd, &msg, sizeof(msg), 0)) != 0) {
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				return;
+			} else if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (n != sizeof(msg)) {
+			continue;
+		}
+
+		switch (msg.op) {
+			case LPFKD_OP_SUBSCRIBE:
+				cl->keys = msg.mask;
+				break;
+			case LPFKD_OP_SET:
+				lpfk_compose_set(comp, cl->layer, msg.mask, msg.value, msg.blink);
+				break;
+			case LPFKD_OP_RELEASE:
+				lpfk_compose_release(comp, cl->layer, msg.mask);
+				break;
+			default:
+				break;
+		}
+	}
+
+	// hung up, or the socket broke
+	drop_client(comp, cl);
+}
+
+static void send_key(CLIENT *clients, const int key)
+{
+	LPFKD_MSG msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = LPFKD_OP_KEY;
+	msg.key = key;
+	msg.mask = LPFK_LED(key);
+
+	// a client which isn't keeping up loses keys, rather than holding up
+	// everyone else
+	for (i=0; i<MAX_CLIENTS; i++) {
+		if ((clients[i].fd >= 0) && (clients[i].keys & LPFK_LED(key))) {
+			send(clients[i].fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("Syntax: %s [options] {commport | -S}\n", prog);
+	printf("  -s path   socket to listen on (default %s)\n", LPFKD_DEFAULT_SOCKET);
+	printf("  -p ms     LED frame period (default 20)\n");
+	printf("  -b count  frames blinking LEDs spend on, then off (default 25)\n");
+	printf("  -S        use the pty simulator instead of a real LPFK\n");
+	printf("  -T file   record the serial traffic to a trace file for lpfkreplay\n");
+	printf("  -L        ask the serial port for low latency\n");
+}
+
+int main(int argc, char **argv)
+{
+	LPFK_CTX ctx;
+	LPFK_OPTIONS opts;
+	LPFK_SIM sim;
+	LPFK_SIM_OPTIONS simopts;
+	LPFK_ANIM anim;
+	LPFK_COMPOSITOR comp;
+	CLIENT clients[MAX_CLIENTS];
+	struct pollfd pfd[3 + MAX_CLIENTS];
+	struct sigaction sa;
+	const char *sockpath = LPFKD_DEFAULT_SOCKET;
+	const char *port = NULL;
+	bool use_sim = false;
+	int period_ms = 20, blink_frames = 25;
+	int lfd, nfds, i, key, lowlat, err, opt;
+
+	lpfk_default_options(&opts);
+
+	while ((opt = getopt(argc, argv, "s:p:b:ST:L")) != -1) {
+		switch (opt) {
+			case 's': sockpath = optarg; break;
+			case 'p': period_ms = atoi(optarg); break;
+			case 'b': blink_frames = atoi(optarg); break;
+			case 'S': use_sim = true; break;
+			case 'T': opts.trace_path = optarg; break;
+			case 'L': opts.flags |= LPFK_OPT_LOW_LATENCY; break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+
+	if (use_sim) {
+		lpfk_sim_default_options(&simopts);
+		if (lpfk_sim_open(&sim, &simopts) != LPFK_E_OK) {
+			fprintf(stderr, "Error creating simulator.\n");
+			return -2;
+		}
+		lpfk_sim_start(&sim);
+		port = lpfk_sim_path(&sim);
+	} else if (optind < argc) {
+		port = argv[optind];
+	} else {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if ((period_ms < 1) || (lpfk_compose_init(&comp, blink_frames) != LPFK_E_OK)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	switch (err = lpfk_open_ex(&ctx, port, &opts)) {
+		case LPFK_E_OK:
+			break;
+		case LPFK_E_PORT_OPEN:
+			fprintf(stderr, "Error opening comm port.\n");
+			return -2;
+		case LPFK_E_NOT_PRESENT:
+			fprintf(stderr, "LPFK not connected to specified port.\n");
+			return -2;
+		case LPFK_E_PARAM:
+			fprintf(stderr, "Error creating trace file.\n");
+			return -2;
+		default:
+			fprintf(stderr, "Unknown error opening LPFK: code %d\n", err);
+			return -2;
+	}
+
+	if (opts.flags & LPFK_OPT_LOW_LATENCY) {
+		lowlat = lpfk_get_low_latency(&ctx);
+		fprintf(stderr, "Low latency: ASYNC_LOW_LATENCY %s, latency timer %s.\n",
+				(lowlat & LPFK_LOWLAT_SERIAL) ? "set" : "not available",
+				(lowlat & LPFK_LOWLAT_TIMER) ? "at 1 ms" : "not available");
+	}
+
+	if ((lfd = listen_on(sockpath)) < 0) {
+		fprintf(stderr, "Error listening on %s.\n", sockpath);
+		lpfk_close(&ctx);
+		return -2;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i=0; i<MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+	}
+
+	lpfk_set_leds(&ctx, false);
+	lpfk_enable(&ctx, true);
+
+	lpfk_anim_init(&anim, &ctx, period_ms);
+	lpfk_anim_set_generator(&anim, lpfk_compose_generator, &comp);
+	if (lpfk_anim_start(&anim) != LPFK_E_OK) {
+		fprintf(stderr, "Error starting frame timer.\n");
+		quit = true;
+	}
+
+	while (!quit) {
+		pfd[0].fd = lpfk_get_fd(&ctx);
+		pfd[0].events = POLLIN;
+		pfd[1].fd = lpfk_anim_get_fd(&anim);
+		pfd[1].events = POLLIN;
+		pfd[2].fd = lfd;
+		pfd[2].events = POLLIN;
+		nfds = 3;
+		for (i=0; i<MAX_CLIENTS; i++) {
+			if (clients[i].fd >= 0) {
+				pfd[nfds].fd = clients[i].fd;
+				pfd[nfds].events = POLLIN;
+				nfds++;
+			}
+		}
+
+		if (poll(pfd, nfds, lpfk_get_timeout(&ctx)) < 0) {
+			if (errno != EINTR) {
+				break;
+			}
+			continue;
+		}
+
+		// keys first, so a client's reaction to one goes out in this frame
+		while ((key = lpfk_read(&ctx)) >= 0) {
+			send_key(clients, key);
+		}
+
+		if (pfd[2].revents) {
+			accept_clients(lfd, &comp, clients);
+		}
+		for (i=0; i<MAX_CLIENTS; i++) {
+			if (clients[i].fd >= 0) {
+				serve_client(&comp, &clients[i]);
+			}
+		}
+
+		if (pfd[1].revents) {
+			lpfk_anim_process(&anim);
+		}
+	}
+
+	for (i=0; i<MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0) {
+			drop_client(&comp, &clients[i]);
+		}
+	}
+	close(lfd);
+	unlink(sockpath);
+
+	lpfk_anim_close(&anim);
+	lpfk_compose_close(&comp);
+	lpfk_close(&ctx);
+	if (use_sim) {
+		lpfk_sim_close(&sim);
+	}
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "liblpfk.h"
 
@@ -13,6 +14,7 @@
 
 #include <termios.h>
 #include <unistd.h>   // for read()
+#include <poll.h>
 
 static struct termios initial_settings, new_settings;
 static int peek_character = -1;
@@ -69,13 +71,18 @@ char ch;
 
 /***********************/
 
-int main(void)
+int main(int argc, char **argv)
 {
 	int i, nei, x, y;
 	bool old_gamegrid[6][6];
 	bool gamegrid[6][6];
 	bool steadyState = false;
 	unsigned long iteration = 0;
+	struct pollfd pfd[2];
+	unsigned long ledmask;
+	bool lit;
+	LPFK_PORT_INFO found;
+	const char *port;
 	LPFK_CTX ctx;
 
 	// initialisation
@@ -84,8 +91,18 @@ int main(void)
 	init_keyboard();
 	atexit(close_keyboard);
 
+	// use the port given on the command line, or go and look for an LPFK
+	if (argc >= 2) {
+		port = argv[1];
+	} else if (lpfk_discover(NULL, &found, 1, NULL) == 1) {
+		port = found.path;
+	} else {
+		printf("No LPFK found; specify the comm port on the command line.\n");
+		return -1;
+	}
+
 	// open lpfk port
-	if ((i = lpfk_open(&ctx, "/dev/ttyUSB0")) != LPFK_E_OK) {
+	if ((i = lpfk_open(&ctx, port)) != LPFK_E_OK) {
 		// error opening lpfk
 		printf("Error opening LPFK: code %d\n", i);
 		return -1;
@@ -96,9 +113,16 @@ int main(void)
 	// allow user to set up their game grid
 	printf("Press the keys on the LPFK to set up the game grid, then press Enter to start the simulation.\n");
 	while (!kbhit()) {
-		i = lpfk_read(&ctx);
-
-		if (i >= 0) {
+		// sleep until either the LPFK or the console has something for us
+		pfd[0].fd = 0;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = lpfk_get_fd(&ctx);
+		pfd[1].events = POLLIN;
+		poll(pfd, 2, lpfk_get_timeout(&ctx));
+
+		// take every key the library has queued; some may already be off
+		// the descriptor, read while an LED update was waiting for its ACK
+		while ((i = lpfk_read(&ctx)) >= 0) {
 #ifdef DEBUG
 			printf("key %d\n", i);
 #endif
@@ -263,16 +287,20 @@ int main(void)
 #endif
 
 		// now update the LPFK from the game grid
+		ledmask = 0;
 		for (i=0; i<32; i++) {
-			if (i < 4)			lpfk_set_led_cached(&ctx, i, gamegrid[0][i+1]);
-			else if (i < 10)	lpfk_set_led_cached(&ctx, i, gamegrid[1][i-4]);
-			else if (i < 16)	lpfk_set_led_cached(&ctx, i, gamegrid[2][i-10]);
-			else if (i < 22)	lpfk_set_led_cached(&ctx, i, gamegrid[3][i-16]);
-			else if (i < 28)	lpfk_set_led_cached(&ctx, i, gamegrid[4][i-22]);
-			else				lpfk_set_led_cached(&ctx, i, gamegrid[5][(i-28)+1]);
+			if (i < 4)			lit = gamegrid[0][i+1];
+			else if (i < 10)	lit = gamegrid[1][i-4];
+			else if (i < 16)	lit = gamegrid[2][i-10];
+			else if (i < 22)	lit = gamegrid[3][i-16];
+			else if (i < 28)	lit = gamegrid[4][i-22];
+			else				lit = gamegrid[5][(i-28)+1];
+
+			if (lit) ledmask |= LPFK_LED(i);
 		}
 
 		// flush updates to the LPFK
+		lpfk_set_mask(&ctx, ledmask);
 		lpfk_update_leds(&ctx);
 
 		// make sure updates aren't too fast
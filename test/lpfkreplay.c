@@ -0,0 +1,241 @@
+// lpfkreplay: play a recorded LPFK session back to the host
+//
+// Stands in for the LPFK on a pseudo-terminal, sending the bytes the LPFK
+// sent in a trace recorded with LPFK_OPTIONS.trace_path. Each burst is sent
+// after the same delay (divided by the speed factor) as it followed the
+// record before it, and the host's bytes are checked against the ones it
+// sent when the trace was recorded: the LPFK's replies wait for the bytes
+// they were replies to, so the replay stays in step with the host however
+// fast it runs. The exit status is 0 if the host sent exactly what it sent
+// before, so a trace makes a regression test.
+
+#define _GNU_SOURCE		// for ptsname_r()
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "liblpfk.h"
+#include "lpfk_trace.h"
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void sleep_until(const long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000LL;
+	ts.tv_nsec = ns % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// wait until as long after the last record as rec came after it when it
+// was recorded
+static void pace(const LPFK_TRACE_REC *rec, const double speed,
+		long long *anchor_ts, long long *anchor_real)
+{
+	long long due = now_ns();
+
+	if (*anchor_real != 0) {
+		due = *anchor_real + (speed ? (rec->ts_ns - *anchor_ts) / speed : 0);
+		sleep_until(due);
+	}
+	*anchor_ts = rec->ts_ns;
+	*anchor_real = due;
+}
+
+// open a pty for the host to talk to; the slave is held open so we don't
+// see a hangup when the host closes it
+static int open_pty(char *path, const size_t len, int *slave)
+{
+	struct termios tio;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if ((grantpt(fd) < 0) || (unlockpt(fd) < 0) || (ptsname_r(fd, path, len) != 0) ||
+			((*slave = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0)) {
+		close(fd);
+		return -1;
+	}
+
+	if (tcgetattr(*slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(*slave, TCSANOW, &tio);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+// get a byte from the host, waiting up to timeout_ms (-1 = forever)
+static int host_byte(const int fd, const int timeout_ms)
+{
+	struct pollfd pfd;
+	unsigned char byte;
+	long long deadline = now_ns() + (timeout_ms * 1000000LL);
+	int remaining = timeout_ms;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		if (read(fd, &byte, 1) == 1) {
+			return byte;
+		}
+		if (timeout_ms >= 0) {
+			remaining = (deadline - now_ns()) / 1000000LL;
+			if (remaining <= 0) {
+				return -1;
+			}
+		}
+		poll(&pfd, 1, remaining);
+	}
+}
+
+static void dump(LPFK_TRACE *trace)
+{
+	const LPFK_TRACE_REC *rec;
+	unsigned long i;
+	long long t0 = 0;
+	int j;
+
+	for (i=0; (rec = lpfk_trace_get(trace, i)) != NULL; i++) {
+		if (i == 0) {
+			t0 = rec->ts_ns;
+		}
+		printf("%12.6f %s", (rec->ts_ns - t0) / 1e9,
+				(rec->dir == LPFK_TRACE_TX) ? "host>" : "<lpfk");
+		for (j=0; j<rec->len; j++) {
+			printf(" %02x", rec->data[j]);
+		}
+		printf("\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("Syntax: %s [options] tracefile\n", prog);
+	printf("  -s factor  speed up (or slow down) the LPFK's delays; 0 for none (default 1)\n");
+	printf("  -t ms      time to wait for the host to send each byte (default 5000)\n");
+	printf("  -x         don't check what the host sends; just play the LPFK's side\n");
+	printf("  -d         print the trace and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	LPFK_TRACE trace;
+	const LPFK_TRACE_REC *rec;
+	char path[LPFK_PATH_MAX];
+	unsigned char junk[64];
+	double speed = 1.0;
+	bool check = true, dump_only = false;
+	int timeout_ms = 5000;
+	long long anchor_ts = 0, anchor_real = 0, start, recorded = 0;
+	unsigned long i, checked = 0, mismatches = 0;
+	int fd, slave, byte, j, opt;
+
+	while ((opt = getopt(argc, argv, "s:t:xd")) != -1) {
+		switch (opt) {
+			case 's': speed = atof(optarg); break;
+			case 't': timeout_ms = atoi(optarg); break;
+			case 'x': check = false; break;
+			case 'd': dump_only = true; break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+
+	if ((optind >= argc) || (speed < 0)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (lpfk_trace_load(&trace, argv[optind]) != LPFK_E_OK) {
+		fprintf(stderr, "Can't read trace file %s.\n", argv[optind]);
+		return -2;
+	}
+
+	if (dump_only) {
+		dump(&trace);
+		lpfk_trace_close(&trace);
+		return 0;
+	}
+
+	if (lpfk_trace_lost(&trace) > 0) {
+		fprintf(stderr, "Warning: the trace wrapped; its first %llu records are lost.\n",
+				lpfk_trace_lost(&trace));
+	}
+
+	if ((fd = open_pty(path, sizeof(path), &slave)) < 0) {
+		fprintf(stderr, "Error creating pseudo-terminal.\n");
+		return -2;
+	}
+
+	printf("%s\n", path);
+	fflush(stdout);
+
+	start = now_ns();
+	for (i=0; (rec = lpfk_trace_get(&trace, i)) != NULL; i++) {
+		if (rec->dir == LPFK_TRACE_TX) {
+			if (!check) {
+				// keep pace with the trace, and throw away what the host sends
+				pace(rec, speed, &anchor_ts, &anchor_real);
+				while (read(fd, junk, sizeof(junk)) > 0)
+					;
+				continue;
+			}
+
+			// wait for the host to send what it sent before; the first
+			// byte waits for as long as it takes the host to start
+			for (j=0; j<rec->len; j++) {
+				byte = host_byte(fd, (checked == 0) ? -1 : timeout_ms);
+				if (byte < 0) {
+					printf("record %lu: host sent nothing; expected %02x\n", i, rec->data[j]);
+					mismatches++;
+					goto done;
+				}
+				if (byte != rec->data[j]) {
+					printf("record %lu: host sent %02x; expected %02x\n", i, byte, rec->data[j]);
+					mismatches++;
+				}
+				checked++;
+			}
+			anchor_ts = rec->ts_ns;
+			anchor_real = now_ns();
+		} else {
+			// send what the LPFK sent, when it sent it
+			pace(rec, speed, &anchor_ts, &anchor_real);
+			write(fd, rec->data, rec->len);
+		}
+	}
+
+done:
+	if (lpfk_trace_count(&trace) > 0) {
+		recorded = lpfk_trace_get(&trace, lpfk_trace_count(&trace) - 1)->ts_ns -
+			lpfk_trace_get(&trace, 0)->ts_ns;
+	}
+	printf("replayed %lu of %lu records in %.3f s (recorded over %.3f s); "
+			"%lu host bytes checked, %lu mismatches\n",
+			i, lpfk_trace_count(&trace), (now_ns() - start) / 1e9, recorded / 1e9,
+			checked, mismatches);
+
+	close(slave);
+	close(fd);
+	lpfk_trace_close(&trace);
+	return (mismatches == 0) ? 0 : 1;
+}
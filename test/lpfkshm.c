@@ -0,0 +1,276 @@
+// lpfkshm: drive an LPFK's LEDs through a shared-memory framebuffer
+//
+// Without -a, opens the LPFK with an I/O thread and creates the framebuffer
+// (see lpfk_shm.h). Each keypress toggles its LED through the framebuffer,
+// so the flusher and the key reader run side by side. With -a, attaches to
+// a framebuffer created by another lpfkshm and changes or reports it.
+//
+// -b changes the framebuffer count times as fast as it can and reports the
+// cost of a change; the flusher sends only the latest mask at line speed.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include "liblpfk.h"
+#include "lpfk_shm.h"
+#include "lpfk_sim.h"
+
+#define DEFAULT_NAME	"/lpfk"
+
+static volatile sig_atomic_t quit = false;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	quit = true;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void print_status(LPFK_SHM *shm)
+{
+	LPFK_SHM_STATUS st;
+
+	lpfk_shm_get_status(shm, &st);
+	printf("mask %08lx, shown %08lx, %llu flushes, last result %d\n",
+			lpfk_shm_get_mask(shm), st.shown, st.flushes, st.result);
+}
+
+static void bench(LPFK_SHM *shm, const long count)
+{
+	LPFK_SHM_STATUS before, after;
+	long long start, elapsed;
+	long i;
+
+	lpfk_shm_get_status(shm, &before);
+	start = now_ns();
+	for (i=0; i<count; i++) {
+		lpfk_shm_modify(shm, 0, 0, LPFK_LED(i % 32));
+	}
+	elapsed = now_ns() - start;
+	lpfk_shm_get_status(shm, &after);
+
+	printf("%ld changes in %lld us, %.1f ns per change, %llu flushes meanwhile\n",
+			count, elapsed / 1000, (double)elapsed / count,
+			after.flushes - before.flushes);
+}
+
+// wait for the flusher to send the current mask; false if it doesn't
+static bool wait_shown(LPFK_SHM *shm)
+{
+	LPFK_SHM_STATUS st;
+	int i;
+
+	for (i=0; i<100; i++) {
+		lpfk_shm_get_status(shm, &st);
+		if ((st.shown == lpfk_shm_get_mask(shm)) && (st.result == LPFK_E_OK)) {
+			return true;
+		}
+		usleep(10000);
+	}
+	return false;
+}
+
+static int attach(const char *name, const long count, const int toggle,
+		const char *mask)
+{
+	LPFK_SHM shm;
+
+	switch (lpfk_shm_attach(&shm, name)) {
+		case LPFK_E_OK:
+			break;
+		case LPFK_E_NOT_PRESENT:
+			fprintf(stderr, "No framebuffer %s; is lpfkshm running?\n", name);
+			return -2;
+		default:
+			fprintf(stderr, "Bad framebuffer name %s.\n", name);
+			return -1;
+	}
+
+	if (mask != NULL) {
+		lpfk_shm_set_mask(&shm, strtoul(mask, NULL, 16));
+	}
+	if (toggle >= 0) {
+		lpfk_shm_modify(&shm, 0, 0, LPFK_LED(toggle));
+	}
+	if (count > 0) {
+		bench(&shm, count);
+	}
+	if ((mask != NULL) || (toggle >= 0) || (count > 0)) {
+		if (!wait_shown(&shm)) {
+			fprintf(stderr, "Flusher hasn't sent the mask.\n");
+		}
+	}
+	print_status(&shm);
+
+	lpfk_shm_close(&shm);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Syntax: %s [options] {commport | -S}\n", prog);
+	printf("        %s -a [options]\n", prog);
+	printf("  -n name   framebuffer name (default %s)\n", DEFAULT_NAME);
+	printf("  -p mode   framebuffer permissions, in octal (default 0600)\n");
+	printf("  -S        use the pty simulator instead of a real LPFK\n");
+	printf("  -a        attach to the framebuffer of a running lpfkshm\n");
+	printf("  -m mask   set the LED mask (hex)\n");
+	printf("  -t key    toggle one LED (0-31)\n");
+	printf("  -b count  time count LED changes; without -a, exit afterwards\n");
+}
+
+int main(int argc, char **argv)
+{
+	LPFK_CTX ctx;
+	LPFK_OPTIONS opts;
+	LPFK_SIM sim;
+	LPFK_SIM_OPTIONS simopts;
+	LPFK_SHM shm;
+	struct pollfd pfd;
+	struct sigaction sa;
+	const char *name = DEFAULT_NAME;
+	const char *port = NULL;
+	const char *mask = NULL;
+	bool use_sim = false, attach_only = false;
+	long count = 0;
+	mode_t mode = 0600;
+	int toggle = -1;
+	int key, err, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:p:Sam:t:b:")) != -1) {
+		switch (opt) {
+			case 'n': name = optarg; break;
+			case 'p': mode = strtoul(optarg, NULL, 8); break;
+			case 'S': use_sim = true; break;
+			case 'a': attach_only = true; break;
+			case 'm': mask = optarg; break;
+			case 't': toggle = atoi(optarg); break;
+			case 'b': count = atol(optarg); break;
+			default: usage(argv[0]); return -1;
+		}
+	}
+
+	if ((toggle > 31) || (count < 0)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (attach_only) {
+		return attach(name, count, toggle, mask);
+	}
+
+	if (use_sim) {
+		lpfk_sim_default_options(&simopts);
+		if (lpfk_sim_open(&sim, &simopts) != LPFK_E_OK) {
+			fprintf(stderr, "Error creating simulator.\n");
+			return -2;
+		}
+		lpfk_sim_start(&sim);
+		port = lpfk_sim_path(&sim);
+	} else if (optind < argc) {
+		port = argv[optind];
+	} else {
+		usage(argv[0]);
+		return -1;
+	}
+
+	// the flusher sends from its own thread, so the I/O thread is a must
+	lpfk_default_options(&opts);
+	opts.flags |= LPFK_OPT_IO_THREAD;
+
+	switch (err = lpfk_open_ex(&ctx, port, &opts)) {
+		case LPFK_E_OK:
+			break;
+		case LPFK_E_PORT_OPEN:
+			fprintf(stderr, "Error opening comm port.\n");
+			return -2;
+		case LPFK_E_NOT_PRESENT:
+			fprintf(stderr, "LPFK not connected to specified port.\n");
+			return -2;
+		default:
+			fprintf(stderr, "Unknown error opening LPFK: code %d\n", err);
+			return -2;
+	}
+
+	lpfk_set_leds(&ctx, false);
+	lpfk_enable(&ctx, true);
+
+	switch (err = lpfk_shm_create(&shm, &ctx, name, mode)) {
+		case LPFK_E_OK:
+			break;
+		case LPFK_E_BUSY:
+			fprintf(stderr, "Framebuffer %s already exists.\n", name);
+			ret = -2;
+			goto out;
+		default:
+			fprintf(stderr, "Error creating framebuffer %s: code %d\n", name, err);
+			ret = -2;
+			goto out;
+	}
+
+	if (mask != NULL) {
+		lpfk_shm_set_mask(&shm, strtoul(mask, NULL, 16));
+	}
+	if (toggle >= 0) {
+		lpfk_shm_modify(&shm, 0, 0, LPFK_LED(toggle));
+	}
+
+	if (count > 0) {
+		bench(&shm, count);
+		if (!wait_shown(&shm)) {
+			fprintf(stderr, "Flusher hasn't sent the mask.\n");
+			ret = -2;
+		} else if (use_sim && (lpfk_sim_get_leds(&sim) != lpfk_shm_get_mask(&shm))) {
+			fprintf(stderr, "Simulator shows %08lx.\n", lpfk_sim_get_leds(&sim));
+			ret = -2;
+		}
+		print_status(&shm);
+		lpfk_shm_close(&shm);
+		goto out;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("Serving %s; press keys to toggle their LEDs, ^C to quit.\n", name);
+	while (!quit) {
+		pfd.fd = lpfk_get_fd(&ctx);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, lpfk_get_timeout(&ctx)) < 0) {
+			if (errno != EINTR) {
+				break;
+			}
+			continue;
+		}
+
+		while ((key = lpfk_read(&ctx)) >= 0) {
+			lpfk_shm_modify(&shm, 0, 0, LPFK_LED(key));
+			printf("key %d: ", key);
+			print_status(&shm);
+		}
+	}
+
+	lpfk_shm_close(&shm);
+out:
+	lpfk_close(&ctx);
+	if (use_sim) {
+		lpfk_sim_close(&sim);
+	}
+
+	return ret;
+}
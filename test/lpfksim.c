@@ -0,0 +1,94 @@
+// lpfksim: simulated LPFK on a pseudo-terminal
+//
+// Prints the path of the simulated serial port, then the LED state whenever
+// the host changes it. Each line typed on stdin is a keypress script for
+// lpfk_sim_script(), e.g. "0@500 1@100 2@100".
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include "liblpfk.h"
+#include "lpfk_sim.h"
+
+static void led_changed(LPFK_SIM *sim, const unsigned long mask, void *user)
+{
+	(void)sim;
+	(void)user;
+	printf("leds %08lx\n", mask);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	LPFK_SIM sim;
+	LPFK_SIM_OPTIONS opts;
+	struct pollfd pfd[2];
+	char line[1024];
+	bool eof = false;
+	int opt;
+
+	lpfk_sim_default_options(&opts);
+
+	while ((opt = getopt(argc, argv, "fl:n:d:")) != -1) {
+		switch (opt) {
+			case 'f':
+				opts.flags &= ~LPFK_SIM_LINE_TIMING;
+				break;
+			case 'l':
+				opts.latency_us = atoi(optarg);
+				break;
+			case 'n':
+				opts.nak_every = atoi(optarg);
+				break;
+			case 'd':
+				opts.ack_drop_every = atoi(optarg);
+				break;
+			default:
+				printf("Syntax: %s [-f] [-l latency_us] [-n nak_every] [-d drop_every] [script]\n", argv[0]);
+				printf("  -f  don't model the 9600 baud line; reply instantly\n");
+				return -1;
+		}
+	}
+
+	if (lpfk_sim_open(&sim, &opts) != LPFK_E_OK) {
+		printf("Error creating pseudo-terminal.\n");
+		return -2;
+	}
+
+	lpfk_sim_set_led_cb(&sim, led_changed, NULL);
+
+	if ((optind < argc) && (lpfk_sim_script(&sim, argv[optind]) != LPFK_E_OK)) {
+		printf("Invalid script.\n");
+		lpfk_sim_close(&sim);
+		return -1;
+	}
+
+	printf("%s\n", lpfk_sim_path(&sim));
+	fflush(stdout);
+
+	for (;;) {
+		pfd[0].fd = lpfk_sim_get_fd(&sim);
+		pfd[0].events = POLLIN;
+		pfd[1].fd = eof ? -1 : 0;
+		pfd[1].events = POLLIN;
+
+		poll(pfd, 2, lpfk_sim_get_timeout(&sim));
+
+		if (pfd[1].revents) {
+			if (fgets(line, sizeof(line), stdin) == NULL) {
+				eof = true;
+			} else if (lpfk_sim_script(&sim, line) != LPFK_E_OK) {
+				printf("Invalid script.\n");
+				fflush(stdout);
+			}
+		}
+
+		lpfk_sim_process(&sim);
+	}
+
+	lpfk_sim_close(&sim);
+	return 0;
+}
@@ -2,10 +2,13 @@
 #include <stdbool.h>
 #include <time.h>
 #include "liblpfk.h"
+#include "lpfk_anim.h"
 
 int main(int argc, char **argv) 
 {
 	LPFK_CTX	ctx;
+	LPFK_ANIM	anim;
+	unsigned long	scan[32];
 	int			i;
 	time_t		tm;
 
@@ -35,27 +38,32 @@ int main(int argc, char **argv)
 	printf("Scanning LEDs, 1-32...\n");
 
 	for (i=0; i<32; i++) {
-		if (i>0) {
-			lpfk_set_led(&ctx, i-1, false);
-		}
-		lpfk_set_led(&ctx, i, true);
-		usleep(100000);
+		scan[i] = LPFK_LED(i);
+	}
+	if ((lpfk_anim_init(&anim, &ctx, 100) == LPFK_E_OK) &&
+			(lpfk_anim_set_sequence(&anim, scan, 32, false) == LPFK_E_OK) &&
+			(lpfk_anim_start(&anim) == LPFK_E_OK)) {
+		lpfk_anim_run(&anim);
+		lpfk_anim_close(&anim);
 	}
 
-	// Turn LEDs off and enable LPFK keystroke input
+	// Turn LEDs off, have the library toggle each key's LED when it's
+	// pressed, and enable LPFK keystroke input
 	lpfk_set_leds(&ctx, false);
+	for (i=0; i<32; i++) {
+		lpfk_set_echo(&ctx, i, LPFK_ECHO_TOGGLE, 0);
+	}
 	lpfk_enable(&ctx, true);
 
 	printf("Now press the keys on the LPFK...\n");
 
-	// scan keys for 5 seconds
+	// scan keys for 30 seconds
 	tm = time(NULL);
 	do {
-		// read keys
-		if ((i = lpfk_read(&ctx)) >= 0) {
-			// key buffered, toggle the LED
-			printf("Key down: #%d\n", i);
-			lpfk_set_led(&ctx, i, !lpfk_get_led(&ctx, i));
+		// wait for a key, sleeping until one arrives or the second is up
+		if ((i = lpfk_wait_key(&ctx, 1000)) >= 0) {
+			// key buffered; the library has already toggled the LED
+			printf("Key down: #%d, LED %s\n", i, lpfk_get_led(&ctx, i) ? "on" : "off");
 		}
 	} while ((time(NULL) - tm) < 30);
 